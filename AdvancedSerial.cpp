@@ -6,26 +6,171 @@
 
 #include "AdvancedSerial.h"
 #include "Arduino.h"
+#include <limits.h>
+#if defined(__AVR__)
+#include <util/crc16.h>
+#endif
 
 // static initializer for the static member.
-AdvancedSerial* AdvancedSerial::pSingletonInstance = 0;
+AdvancedSerial* AdvancedSerial::WireSlaveInstance = 0;
+
+// Number of bytes a value occupies in a data frame, indexed by dataType
+static const byte ASI_TYPE_SIZE[] = {
+  1, // asi_bool
+  1, // asi_byte
+  2, // asi_short
+  4, // asi_long
+  2, // asi_ushort
+  4, // asi_ulong
+  2, // asi_int
+  2, // asi_uint
+  4, // asi_float
+  8, // asi_double
+  1, // asi_scaled8
+  2, // asi_scaled16
+  0  // asi_block: ASIBlockValue.Size
+};
+
+// Size of the variable behind LoggedSignal.addr, indexed by dataType
+static const byte ASI_NATIVE_SIZE[] = {
+  sizeof(bool),
+  sizeof(byte),
+  sizeof(short),
+  sizeof(long),
+  sizeof(unsigned short),
+  sizeof(unsigned long),
+  sizeof(int),
+  sizeof(unsigned int),
+  sizeof(float),
+  sizeof(double),
+  0, // asi_scaled8: descriptor, see packValue()
+  0, // asi_scaled16
+  0  // asi_block
+};
+
+// <DTYPE> sent in B0 symbol lists, indexed by dataType
+static const byte ASI_TYPE_CODE[] = {
+  0, // asi_bool
+  1, // asi_byte
+  2, // asi_short
+  5, // asi_long
+  4, // asi_ushort
+  6, // asi_ulong
+  3, // asi_int
+  4, // asi_uint
+  7, // asi_float
+  8, // asi_double
+  9, // asi_scaled8
+  10, // asi_scaled16
+  11 // asi_block
+};
+
+#if ASI_STATS
+#define ASI_CMD_STATS cmdStats
+#else
+#define ASI_CMD_STATS 0 //a built-in without handler is not found
+#endif
+
+//Built-in commands, sorted by asiCommandHash() of the name so findCommand() can search them binary
+#define ASI_BUILTIN_COMMANDS(X) \
+  X("LOGGING_TIMESTAMPS", cmdTimestamps)          /* 0x10B2 */ \
+  X("LOGGING_ACTIVATE_MS", cmdActivateMs)         /* 0x171B */ \
+  X("LOGGING_SETCOMPRESSED", cmdSetCompressed)    /* 0x1FEC */ \
+  X("LOGGING_DEACTIVATE", cmdDeactivate)          /* 0x3305 */ \
+  X("LOGGING_UNSUBSCRIBE", cmdUnsubscribe)        /* 0x43B0 */ \
+  X("LOGGING_GETAGGREGATE", cmdGetAggregate)      /* 0x5392 */ \
+  X("LOGGING_GETBURST", cmdGetBurst)              /* 0x595B */ \
+  X("LOGGING_TRIGGER", cmdTrigger)                /* 0x6D3F */ \
+  X("LOGGING_SUBSCRIBERANGE", cmdSubscribeRange)  /* 0x719A */ \
+  X("LOGGING_DISCOVER", cmdDiscover)              /* 0x828A */ \
+  X("LOGGING_GETDATA", cmdGetData)                /* 0x9805 */ \
+  X("LOGGING_GETSIGNALLIST", cmdGetSignalList)    /* 0x9CA5 */ \
+  X("LOGGING_STATS", ASI_CMD_STATS)               /* 0xA1FA */ \
+  X("LOGGING_SETDELTA", cmdSetDelta)              /* 0xA561 */ \
+  X("LOGGING_SUBSCRIBE", cmdSubscribe)            /* 0xA64D */ \
+  X("LOGGING_FRAMING", cmdFraming)                /* 0xAA8F */ \
+  X("LOGGING_GETDELTA", cmdGetDelta)              /* 0xAAD5 */ \
+  X("LOGGING_GETCOMPRESSED", cmdGetCompressed)    /* 0xADE0 */ \
+  X("LOGGING_SETAGGREGATE", cmdSetAggregate)      /* 0xB41E */ \
+  X("LOGGING_GETHASH", cmdGetHash)                /* 0xC96F */ \
+  X("LOGGING_ACTIVATE", cmdActivate)              /* 0xD23C */ \
+  X("LOGGING_LATCH", cmdLatch)                    /* 0xD9D7 */
+
+#define ASI_BUILTIN_COMMAND(Name, Handler) { Name, Handler, asiCommandHash(Name) },
+#define ASI_BUILTIN_HASH(Name, Handler) asiCommandHash(Name),
+
+const ASIBuiltinCommand AdvancedSerial::BuiltinCommands[] PROGMEM = {
+  ASI_BUILTIN_COMMANDS(ASI_BUILTIN_COMMAND)
+};
+
+static constexpr uint16_t ASI_BUILTIN_HASHES[] = { ASI_BUILTIN_COMMANDS(ASI_BUILTIN_HASH) };
+
+constexpr bool asiStrictlyAscending(const uint16_t * hashes, size_t count) {
+  return count < 2 || (hashes[0] < hashes[1] && asiStrictlyAscending(hashes + 1, count - 1));
+}
+
+static_assert(asiStrictlyAscending(ASI_BUILTIN_HASHES, sizeof(ASI_BUILTIN_HASHES) / sizeof(ASI_BUILTIN_HASHES[0])),
+              "ASI_BUILTIN_COMMANDS has to be sorted by asiCommandHash() without two equal hashes");
 
-AdvancedSerial::AdvancedSerial() {
 
+// the configuration this file was compiled with, see ASI_CONFIG
+const byte ASI_CONFIG = 0;
+
+void AdvancedSerial::construct(byte config) {
+  //config: ASI_CONFIG of the sketch, only read so a sketch with other layout macros fails to link
+  (void)config;
+  memset(Commands, 0, sizeof(Commands));
+#if ASI_STATS
+  resetStats();
+#endif
 }
 
 AdvancedSerial::~AdvancedSerial() {
-  delete Signals;
+  if (WireSlaveInstance == this) WireSlaveInstance = 0;
+  if (!StaticStorage) {
+    delete[] Signals;
+    delete[] FrameBuffer;
+    delete[] Descriptors;
+  }
+  if (TxBufferOwned) delete[] TxBuffer;
+  delete[] DeltaShadow;
+  delete[] Aggregates;
+  delete[] SubscriptionGroup;
+  if (SampleBufferOwned) delete[] SampleBuffer;
+  delete[] CobsBuffer;
+  delete[] WireSnapshot;
+  delete[] PollBuffer;
+  for (byte s = 0; s < SlaveCount; s++) delete[] Slaves[s].Cache;
 }
 
-void AdvancedSerial::begin(HardwareSerial *Ref, unsigned int Size)
+void AdvancedSerial::begin(Stream *Ref, unsigned int Size)
 {
   maxSignalCount = Size;
   SerialRef = Ref;
   Signals = new LoggedSignal[Size];
+  if (Signals == 0) maxSignalCount = 0;
+}
+
+void AdvancedSerial::begin(Stream *Ref, unsigned int Size, uint32_t WireClockFrequency, bool isMaster, byte SlaveID)
+{
+  beginWire(WireClockFrequency, isMaster, SlaveID);
+  begin(Ref, Size);
 }
 
-void AdvancedSerial::begin(HardwareSerial *Ref, unsigned int Size, uint32_t WireClockFrequency, bool isMaster, byte SlaveID)
+void AdvancedSerial::attachStorage(Stream *Ref, LoggedSignal * signals, unsigned int Size, byte * frameBuffer, unsigned int frameBufferSize,
+                                   ASIDescriptor * descriptors, unsigned int descriptorCount)
+{
+  maxSignalCount = Size;
+  SerialRef = Ref;
+  Signals = signals;
+  FrameBuffer = frameBuffer;
+  FrameBufferSize = frameBufferSize;
+  Descriptors = descriptors;
+  DescriptorCapacity = descriptorCount;
+  StaticStorage = true;
+}
+
+void AdvancedSerial::beginWire(uint32_t WireClockFrequency, bool isMaster, byte SlaveID)
 {
 
   if (isMaster)
@@ -38,16 +183,16 @@ void AdvancedSerial::begin(HardwareSerial *Ref, unsigned int Size, uint32_t Wire
     LOGGING_MODE = 2;
     SLAVE_ID = SlaveID;
     if (SLAVE_ID > 127) SLAVE_ID = 127;
-    String s = "S";
-    SlaveSymbolPrefix = s + SLAVE_ID + "_";
+    snprintf(SlaveSymbolPrefix, sizeof(SlaveSymbolPrefix), "S%u_", SLAVE_ID);
 
-    AdvancedSerial::pSingletonInstance = this; // Assign the static singleton used in the static handlers.
-    Wire.onReceive(AdvancedSerial::OnSendHandler);
-    Wire.onRequest(AdvancedSerial::OnReceiveHandler);
+    AdvancedSerial::WireSlaveInstance = this; // The device has one slave address, a later slave instance takes it over
+    Wire.onReceive(AdvancedSerial::OnReceiveHandler);
+    Wire.onRequest(AdvancedSerial::OnRequestHandler);
     Wire.begin(SlaveID);
+#if defined(TWAR) && defined(TWGCE)
+    TWAR |= _BV(TWGCE); //also listen to the general call (address 0), used by latchSlaves()
+#endif
   }
-
-  begin(Ref, Size);
 }
 
 
@@ -55,186 +200,450 @@ void AdvancedSerial::setCommandCallback(void (*readCallback) (char * command, in
   _readCallback = readCallback;
 }
 
+void AdvancedSerial::setCommandCallback(void (*readCallback) (char * command, long * parameter, byte parameterCount, char * string01)) {
+  _readCallbackLong = readCallback;
+}
+
 void AdvancedSerial::deleteSignals() {
+  unsubscribeAll();
+  DescriptorCount = 0;
   signalCount = 0;
+  SymbolHash = ASI_SYMBOL_HASH_INIT;
+  DataFrameLength = ASI_HEADER_LENGTH + ASI_TRAILER_LENGTH;
+  DeltaKeyframeDue = true;
+  resetSampleBuffer();
+  republishSnapshot();
 }
 
-void AdvancedSerial::addSignal(String Name, bool * value) {
+bool AdvancedSerial::registerSignal(const char * Name, dataType Type, void * value, byte Flags) {
+  if (signalCount >= maxSignalCount) return false;
+
   Signals[signalCount].Name = Name;
-  if (LOGGING_MODE == 2) {
-    Signals[signalCount].Name = SlaveSymbolPrefix + Name;
-  }
-  Signals[signalCount].Type = asi_bool;
+  Signals[signalCount].Type = Type;
+  Signals[signalCount].Flags = Flags;
   Signals[signalCount].addr = value;
+  unsigned int frameLength = DataFrameLength + ASI_ID_LENGTH + signalSize(Signals[signalCount]);
+  //A static frame buffer can't grow: the frame with extended header has to fit, or nothing would be sent
+  if (StaticStorage && frameLength + ASI_EXTENDED_HEADER_LENGTH > FrameBufferSize) return false;
+  updateSymbolHash(Signals[signalCount]);
+  DataFrameLength = frameLength;
+  DeltaKeyframeDue = true;
   signalCount++;
+  resetSampleBuffer();
+  republishSnapshot();
+  return true;
 }
 
-void AdvancedSerial::addSignal(String Name, double * value) {
-  Signals[signalCount].Name = Name;
-  if (LOGGING_MODE == 2) {
-    Signals[signalCount].Name = SlaveSymbolPrefix + Name;
-  }
-  Signals[signalCount].Type = asi_double;
-  Signals[signalCount].addr = value;
-  signalCount++;
+bool AdvancedSerial::registerScaled(const char * Name, dataType Type, void * value, byte Flags, float scale, float offset, byte bits) {
+  if (signalCount >= maxSignalCount || scale == 0) return false;
+  ASIDescriptor * descriptor = reserveDescriptor();
+  if (descriptor == 0) return false;
+  ASIScaledValue * scaled = &descriptor->Scaled;
+  scaled->addr = value;
+  scaled->SourceType = Type;
+  scaled->Scale = scale;
+  scaled->Offset = offset;
+  if (!registerSignal(Name, bits == 8 ? asi_scaled8 : asi_scaled16, scaled, Flags)) return false;
+  DescriptorCount++;
+  return true;
 }
 
-void AdvancedSerial::addSignal(String Name, float * value) {
-  Signals[signalCount].Name = Name;
-  if (LOGGING_MODE == 2) {
-    Signals[signalCount].Name = SlaveSymbolPrefix + Name;
+ASIDescriptor * AdvancedSerial::reserveDescriptor() {
+  //Next free slot, taken with DescriptorCount++ once the signal is registered.
+  //AdvancedSerial adds ASI_DESCRIPTOR_STEP slots when they are used up, AdvancedSerialStatic has a fixed number
+  if (DescriptorCount >= DescriptorCapacity) {
+    if (StaticStorage) return 0;
+    unsigned int capacity = DescriptorCapacity + ASI_DESCRIPTOR_STEP;
+    ASIDescriptor * slots = new ASIDescriptor[capacity];
+    if (slots == 0) return 0;
+
+    //The signals point into the slots (sample() may read them in an ISR)
+    noInterrupts();
+    if (DescriptorCount > 0) memcpy(slots, Descriptors, DescriptorCount * sizeof(ASIDescriptor));
+    for (unsigned int i = 0; i < signalCount; i++) {
+      if (Signals[i].Type != asi_scaled8 && Signals[i].Type != asi_scaled16 && Signals[i].Type != asi_block) continue;
+      Signals[i].addr = slots + ((ASIDescriptor *)Signals[i].addr - Descriptors);
+    }
+    ASIDescriptor * old = Descriptors;
+    Descriptors = slots;
+    DescriptorCapacity = capacity;
+    interrupts();
+    delete[] old;
   }
-  Signals[signalCount].Type = asi_float;
-  Signals[signalCount].addr = value;
-  signalCount++;
+  return &Descriptors[DescriptorCount];
 }
 
-void AdvancedSerial::addSignal(String Name, unsigned long * value) {
-  Signals[signalCount].Name = Name;
-  if (LOGGING_MODE == 2) {
-    Signals[signalCount].Name = SlaveSymbolPrefix + Name;
+bool AdvancedSerial::registerBlock(const char * Name, void * value, const ASIField * fields, byte fieldCount, byte Flags) {
+  //Slaves send values in I2C chunks of up to 8 bytes, so blocks stay on the device itself
+  if (signalCount >= maxSignalCount || LOGGING_MODE == 2) return false;
+  if (fieldCount == 0 || fieldCount > ASI_MAX_BLOCK_FIELDS) return false;
+  for (byte f = 0; f < fieldCount; f++) {
+    if (fields[f].Type > asi_double || fields[f].Count == 0) return false;
   }
-  Signals[signalCount].Type = asi_ulong;
-  Signals[signalCount].addr = value;
-  signalCount++;
+
+  ASIDescriptor * descriptor = reserveDescriptor();
+  if (descriptor == 0) return false;
+  ASIBlockValue * block = &descriptor->Block;
+  block->addr = value;
+  //A single field (arrays) is kept in the slot, see ASIBlockValue::field()
+  block->Field = fields[0];
+  block->Fields = fields;
+  block->FieldCount = fieldCount;
+  block->Size = 0;
+  for (byte f = 0; f < fieldCount; f++) {
+    block->Size += fields[f].Count * ASI_TYPE_SIZE[fields[f].Type];
+  }
+
+  if (!registerSignal(Name, asi_block, block, Flags)) return false;
+  DescriptorCount++;
+  return true;
 }
 
-void AdvancedSerial::addSignal(String Name, int * value) {
-  Signals[signalCount].Name = Name;
-  if (LOGGING_MODE == 2) {
-    Signals[signalCount].Name = SlaveSymbolPrefix + Name;
+unsigned int AdvancedSerial::signalSize(const LoggedSignal & sym) {
+  if (sym.Type == asi_block) return ((const ASIBlockValue *)sym.addr)->Size;
+  return ASI_TYPE_SIZE[sym.Type];
+}
+
+byte AdvancedSerial::packMetadata(byte * dst, const LoggedSignal & sym) {
+  //Bytes following <DTYPE> in the symbol list, see metadataLength()
+  if (sym.Type == asi_scaled8 || sym.Type == asi_scaled16) {
+    const ASIScaledValue * scaled = (const ASIScaledValue *)sym.addr;
+    memcpy(dst, &scaled->Scale, 4);
+    memcpy(dst + 4, &scaled->Offset, 4);
+    return 8;
   }
-  Signals[signalCount].Type = asi_int;
-  Signals[signalCount].addr = value;
-  signalCount++;
+  if (sym.Type == asi_block) {
+    //<FIELDS>, FIELDS x <DTYPE><COUNT>
+    const ASIBlockValue * block = (const ASIBlockValue *)sym.addr;
+    byte * p = dst;
+    *p++ = block->FieldCount;
+    for (byte f = 0; f < block->FieldCount; f++) {
+      *p++ = ASI_TYPE_CODE[block->field(f).Type];
+      *p++ = lowByte(block->field(f).Count);
+      *p++ = highByte(block->field(f).Count);
+    }
+    return p - dst;
+  }
+  return 0;
 }
 
-void AdvancedSerial::addSignal(String Name, byte * value) {
-  Signals[signalCount].Name = Name;
+byte AdvancedSerial::metadataLength(byte typeCode) {
+  //Only for the types a slave can send (no blocks)
+  return (typeCode == 9 || typeCode == 10) ? 8 : 0;
+}
+
+void AdvancedSerial::updateSymbolHash(const LoggedSignal & sym) {
+  //FNV-1a over "<Name>\0<DTYPE>" of every signal in order, so it only has to be extended in addSignal()
+  char name[64];
+  byte length = copyName(name, sizeof(name), sym);
+  for (byte i = 0; i <= length; i++) SymbolHash = (SymbolHash ^ (byte)name[i]) * 16777619UL;
+  SymbolHash = (SymbolHash ^ ASI_TYPE_CODE[sym.Type]) * 16777619UL;
+  byte metadata[ASI_MAX_METADATA_LENGTH];
+  byte metadataBytes = packMetadata(metadata, sym);
+  for (byte i = 0; i < metadataBytes; i++) SymbolHash = (SymbolHash ^ metadata[i]) * 16777619UL;
+}
+
+byte AdvancedSerial::copyName(char * dst, byte size, const LoggedSignal & sym) {
+  //Copies "<SlaveSymbolPrefix><Name>" into dst, cut off at size - 1 chars
+  byte length = 0;
   if (LOGGING_MODE == 2) {
-    Signals[signalCount].Name = SlaveSymbolPrefix + Name;
+    for (const char * c = SlaveSymbolPrefix; *c != '\0' && length < size - 1; c++) dst[length++] = *c;
   }
-  Signals[signalCount].Type = asi_byte;
-  Signals[signalCount].addr = value;
-  signalCount++;
+  const char * name = sym.Name;
+  while (length < size - 1) {
+    char c = (sym.Flags & ASI_NAME_IN_FLASH) ? pgm_read_byte(name) : *name;
+    if (c == '\0') break;
+    dst[length++] = c;
+    name++;
+  }
+  dst[length] = '\0';
+  return length;
 }
 
 
 void AdvancedSerial::Read() {
 
+  update();
+
   if (recvWithStartEndMarkers() == true) {
-    parseData();
-    Serial.print(F("<"));
-    Serial.print(receivedChars);
-    Serial.println(F(">"));
+    ASI_TIMER_START(start_us);
+    ASI_STAT_ADD(CommandsReceived, 1);
+    if (CommandEcho && CobsBuffer == 0) {
+      txBeginFrame();
+      txWrite('<');
+      txWrite((const byte *)receivedChars, strlen(receivedChars));
+      txWrite((const byte *)">\r\n", 3);
+      txEndFrame(false); //like the plain print() it replaced, Read() does not wait for the echo
+    }
 
-    if (strcmp(COMMAND, "LOGGING_GETSIGNALLIST") == 0)
-    {
-      unsigned long msg_id = ((unsigned long)PARAMETER[3] << 24) | ((unsigned long)PARAMETER[2] << 16)
-                             | ((unsigned long)PARAMETER[1] << 8) | ((unsigned long)PARAMETER[0]);
+    ASICommandHandler handler = findCommand();
+    if (handler) handler(this, PARAMETER, ParameterCount, STRING_01);
 
-      if (LOGGING_MODE == 0 || LOGGING_MODE == 2) {
-        this->TransmitSymbols(msg_id, true);
-      } else if (LOGGING_MODE == 1) {
-        this->WireTransmitSymbols(msg_id, true);
-      }
+    if (_readCallbackLong) _readCallbackLong(COMMAND, PARAMETER, ParameterCount, STRING_01);
+    if (_readCallback) {
+      int parameter[10];
+      for (byte i = 0; i < 10; i++) parameter[i] = PARAMETER[i];
+      _readCallback(COMMAND, parameter, STRING_01);
+    }
+    ASI_TIMER_STOP(Command_us, start_us);
+  }
+}
 
+void AdvancedSerial::setCommandEcho(bool echo) {
+  CommandEcho = echo;
+}
 
-    } else if (strcmp(COMMAND, "LOGGING_GETDATA") == 0)
-    {
-      unsigned long msg_id = ((unsigned long)PARAMETER[3] << 24) | ((unsigned long)PARAMETER[2] << 16)
-                             | ((unsigned long)PARAMETER[1] << 8) | ((unsigned long)PARAMETER[0]);
+bool AdvancedSerial::registerCommand(const char * name, ASICommandHandler handler) {
+  return addCommand(name, 0, handler);
+}
 
-      if (LOGGING_MODE == 0 || LOGGING_MODE == 2) {
-        this->TransmitData(msg_id, true);
-      } else if (LOGGING_MODE == 1) {
-        this->WireTransmitData(msg_id, true);
-      }
+bool AdvancedSerial::registerCommand(const __FlashStringHelper * name, ASICommandHandler handler) {
+  return addCommand((const char *)name, ASI_NAME_IN_FLASH, handler);
+}
 
-    }  else if (strcmp(COMMAND, "LOGGING_ACTIVATE") == 0)
-    {
-      unsigned long parameter = PARAMETER[0];
-      if (parameter > 32767) parameter = 32767;
-      unsigned long unit_multiplicator = 1000;
-      unsigned long loggingInterval_ms = parameter * unit_multiplicator;
+uint16_t AdvancedSerial::hashChar(uint16_t hash, char c) {
+  return (hash << 5) + hash + (byte)c; //djb2
+}
 
-      setInitialIntervalSettings(true, loggingInterval_ms);
+bool AdvancedSerial::addCommand(const char * name, byte flags, ASICommandHandler handler) {
+  if (handler == 0) return false;
 
-    }  else if (strcmp(COMMAND, "LOGGING_DEACTIVATE") == 0)
-    {
-      setInitialIntervalSettings(false, LoggingInterval_ms);
+  uint16_t hash = 5381;
+  for (byte i = 0; i < sizeof(COMMAND) - 1; i++) {
+    char c = (flags & ASI_NAME_IN_FLASH) ? pgm_read_byte(name + i) : name[i];
+    if (c == '\0') break;
+    hash = hashChar(hash, c);
+  }
+
+  //Open addressing: an existing entry with the same name is replaced, so built-ins can be overridden
+  for (byte probe = 0; probe < ASI_MAX_COMMANDS; probe++) {
+    ASICommand & entry = Commands[(hash + probe) & (ASI_MAX_COMMANDS - 1)];
+    bool sameName = entry.Handler != 0 && entry.Hash == hash && sameCommandName(entry.Name, entry.Flags, name, flags);
+    if (entry.Handler == 0 || sameName) {
+      entry.Name = name;
+      entry.Flags = flags;
+      entry.Hash = hash;
+      entry.Handler = handler;
+      return true;
+    }
+  }
+  return false; //table full
+}
+
+bool AdvancedSerial::sameCommandName(const char * a, byte aFlags, const char * b, byte bFlags) {
+  //strcmp_P() only takes its second argument from flash
+  bool aFlash = aFlags & ASI_NAME_IN_FLASH;
+  bool bFlash = bFlags & ASI_NAME_IN_FLASH;
+  if (!aFlash && !bFlash) return strcmp(a, b) == 0;
+  if (!aFlash) return strcmp_P(a, b) == 0;
+  if (!bFlash) return strcmp_P(b, a) == 0;
+  for (;; a++, b++) {
+    char c = pgm_read_byte(a);
+    if (c != (char)pgm_read_byte(b)) return false;
+    if (c == '\0') return true;
+  }
+}
+
+ASICommandHandler AdvancedSerial::findCommand() {
+  //registerCommand() entries first, they replace a built-in with the same name
+  for (byte probe = 0; probe < ASI_MAX_COMMANDS; probe++) {
+    ASICommand & entry = Commands[(CommandHash + probe) & (ASI_MAX_COMMANDS - 1)];
+    if (entry.Handler == 0) break;
+    if (entry.Hash != CommandHash) continue;
+    int cmp = (entry.Flags & ASI_NAME_IN_FLASH) ? strcmp_P(COMMAND, entry.Name) : strcmp(COMMAND, entry.Name);
+    if (cmp == 0) return entry.Handler;
+  }
+  //Built-ins: binary search by hash, no two have the same (see ASI_BUILTIN_COMMANDS)
+  byte low = 0;
+  byte high = sizeof(BuiltinCommands) / sizeof(BuiltinCommands[0]);
+  while (low < high) {
+    byte mid = (low + high) / 2;
+    uint16_t hash = pgm_read_word(&BuiltinCommands[mid].Hash);
+    if (hash < CommandHash) {
+      low = mid + 1;
+    } else if (hash > CommandHash) {
+      high = mid;
+    } else {
+      if (strcmp_P(COMMAND, BuiltinCommands[mid].Name) != 0) return 0;
+      return (ASICommandHandler)pgm_read_ptr(&BuiltinCommands[mid].Handler);
     }
+  }
+  return 0;
+}
+
+unsigned long AdvancedSerial::messageID(long * parameter) {
+  //<MSGID> is sent as 4 byte parameters, least significant byte first
+  return ((unsigned long)(byte)parameter[3] << 24) | ((unsigned long)(byte)parameter[2] << 16)
+         | ((unsigned long)(byte)parameter[1] << 8) | ((unsigned long)(byte)parameter[0]);
+}
+
+void AdvancedSerial::cmdGetSignalList(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  if (asi->LOGGING_MODE == 0 || asi->LOGGING_MODE == 2) {
+    asi->TransmitSymbols(messageID(parameter), true);
+  } else if (asi->LOGGING_MODE == 1) {
+    asi->WireTransmitSymbols(messageID(parameter), true);
+  }
+}
+
+void AdvancedSerial::cmdGetData(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  if (asi->LOGGING_MODE == 0 || asi->LOGGING_MODE == 2) {
+    asi->TransmitData(messageID(parameter), true);
+  } else if (asi->LOGGING_MODE == 1) {
+    asi->WireTransmitData(messageID(parameter), true);
+  }
+}
+
+void AdvancedSerial::cmdGetDelta(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  if (asi->LOGGING_MODE == 0 || asi->LOGGING_MODE == 2) {
+    asi->TransmitDeltaData(messageID(parameter), true);
+  } else if (asi->LOGGING_MODE == 1) {
+    asi->WireTransmitData(messageID(parameter), true);
+  }
+}
+
+void AdvancedSerial::cmdSetDelta(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  unsigned int keyframeInterval = parameter[0] < 0 ? 0 : parameter[0];
+  asi->setDeltaFrames(keyframeInterval);
+}
+
+void AdvancedSerial::cmdActivate(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  unsigned long seconds = parameter[0];
+  if (seconds > 32767) seconds = 32767;
+  unsigned long unit_multiplicator = 1000;
+  unsigned long loggingInterval_ms = seconds * unit_multiplicator;
+
+  asi->setInitialIntervalSettings(true, loggingInterval_ms);
+}
 
-    _readCallback(COMMAND, PARAMETER, STRING_01);
+void AdvancedSerial::cmdDeactivate(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  asi->setInitialIntervalSettings(false, asi->LoggingInterval_ms);
+}
+
+void AdvancedSerial::cmdActivateMs(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  asi->setInitialIntervalSettings(true, parameter[0] < 0 ? 0 : parameter[0]);
+}
+
+void AdvancedSerial::cmdSubscribe(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  if (parameter[0] <= 0) return;
+  for (byte i = 1; i < parameterCount; i++) {
+    if (parameter[i] >= 0) asi->subscribeSignal(parameter[i], parameter[0]);
+  }
+}
+
+void AdvancedSerial::cmdSubscribeRange(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  if (parameter[0] <= 0 || parameter[1] < 0 || parameterCount < 3) return;
+  for (long id = parameter[1]; id <= parameter[2] && id < (long)asi->signalCount; id++) {
+    asi->subscribeSignal(id, parameter[0]);
+  }
+}
+
+void AdvancedSerial::cmdUnsubscribe(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  if (parameterCount == 0) {
+    asi->unsubscribeAll();
+    return;
+  }
+  for (byte i = 0; i < parameterCount; i++) {
+    if (parameter[i] >= 0) asi->unsubscribeSignal(parameter[i]);
   }
 }
 
 bool AdvancedSerial::recvWithStartEndMarkers() {
-  bool newData = false;
-  static boolean recvInProgress = false;
-  static byte ndx = 0;
-  char startMarker = '<';
-  char endMarker = '>';
-  char rc;
-
-  while (SerialRef->available() > 0 && newData == false) {
-    rc = SerialRef->read();
-    if (recvInProgress == true) {
-      if (rc != endMarker) {
-        receivedChars[ndx] = rc;
-        ndx++;
-        if (ndx >= numChars) {
-          ndx = numChars - 1;
-        }
-      }
-      else {
-        receivedChars[ndx] = '\0'; // terminate the string
-        recvInProgress = false;
-        ndx = 0;
-        newData = true;
-      }
+  while (SerialRef->available() > 0) {
+    if (parseChar(SerialRef->read())) return true;
+  }
+  return false;
+}
+
+bool AdvancedSerial::parseChar(char rc) {
+  //Returns true when the end marker of a command was received
+  const char startMarker = '<';
+  const char endMarker = '>';
+
+  if (rc == startMarker) {
+    //(Re)start a command, a missing parameter reads as 0
+    memset(PARAMETER, 0, sizeof(PARAMETER));
+    ParameterCount = 0;
+    COMMAND[0] = '\0';
+    STRING_01[0] = '\0';
+    CommandHash = 5381;
+    RxIndex = 0;
+    RxTokenLength = 0;
+    RxNegative = false;
+    RxConverting = true;
+    RxTruncated = false;
+    RxState = 1;
+    return false;
+  }
+  if (RxState == 0) return false;
+
+  if (rc == endMarker) {
+    parseToken();
+    receivedChars[RxIndex] = '\0'; // terminate the string
+    if (RxTruncated) CommandsTruncated++;
+    RxState = 0;
+    return true;
+  }
+
+  if (RxIndex < numChars - 1) {
+    receivedChars[RxIndex++] = rc;
+  } else {
+    RxTruncated = true;
+  }
+
+  if (rc == ',' || rc == ' ') {
+    parseToken();
+    return false;
+  }
+
+  if (RxState == 1) {
+    if (RxTokenLength < sizeof(COMMAND) - 1) {
+      COMMAND[RxTokenLength] = rc;
+      CommandHash = hashChar(CommandHash, rc);
     }
-    else if (rc == startMarker) {
-      recvInProgress = true;
+    if (RxTokenLength < 255) RxTokenLength++;
+    return false;
+  }
+
+  //PARAMETER 1 is stored in PARAMETER[0] & STRING_01 (if PARAMETER 1 is a string)
+  if (ParameterCount == 0 && RxTokenLength < sizeof(STRING_01) - 1) {
+    STRING_01[RxTokenLength] = rc;
+    STRING_01[RxTokenLength + 1] = '\0';
+  }
+  if (RxTokenLength < 255) RxTokenLength++;
+
+  //Same as strtol(): optional sign, then digits up to the first other char, saturated at LONG_MIN/LONG_MAX.
+  //A negative value is accumulated negative, so LONG_MIN fits
+  if (ParameterCount < 10 && RxConverting) {
+    if (rc >= '0' && rc <= '9') {
+      long & value = PARAMETER[ParameterCount];
+      byte digit = rc - '0';
+      if (!RxNegative) {
+        value = (value > (LONG_MAX - digit) / 10) ? LONG_MAX : value * 10 + digit;
+      } else {
+        value = (value < (LONG_MIN + digit) / 10) ? LONG_MIN : value * 10 - digit;
+      }
+    } else if ((rc == '-' || rc == '+') && RxTokenLength == 1) {
+      RxNegative = (rc == '-');
+    } else {
+      RxConverting = false;
     }
   }
+  return false;
+}
+
+void AdvancedSerial::parseToken() {
+  //Consecutive delimiters do not count as empty tokens (like strtok())
+  if (RxTokenLength == 0) return;
 
-  return newData;
-}
-
-void AdvancedSerial::parseData() {      // split the data into its parts
-  //strcpy(tempChars, receivedChars);
-  // this temporary copy is necessary to protect the original data
-  //   because strtok() used in parseData() replaces the commas with \0
-  char tempChars[sizeof(receivedChars)];
-  strcpy(tempChars, receivedChars);
-  char * strtokIndx;
-  strtokIndx = strtok(tempChars, ", ");
-  strcpy(COMMAND, strtokIndx);
-
-  strtokIndx = strtok(NULL, ", ");
-  //PARAMETER 1 is stored in PARAMETER_01 & STRING_01 (if PARAMETER 1 is a string)
-  strncpy(STRING_01, strtokIndx, 15); //Only copy first 15 chars
-  STRING_01[15] = '\0';              //16th Char = Null Terminator
-  PARAMETER[0] = atoi(strtokIndx);
-  strtokIndx = strtok(NULL, ", ");
-  PARAMETER[1] = atoi(strtokIndx);
-  strtokIndx = strtok(NULL, ", ");
-  PARAMETER[2] = atoi(strtokIndx);
-  strtokIndx = strtok(NULL, ", ");
-  PARAMETER[3] = atoi(strtokIndx);
-  strtokIndx = strtok(NULL, ", ");
-  PARAMETER[4] = atoi(strtokIndx);
-  strtokIndx = strtok(NULL, ", ");
-  PARAMETER[5] = atoi(strtokIndx);
-  strtokIndx = strtok(NULL, ", ");
-  PARAMETER[6] = atoi(strtokIndx);
-  strtokIndx = strtok(NULL, ", ");
-  PARAMETER[7] = atoi(strtokIndx);
-  strtokIndx = strtok(NULL, ", ");
-  PARAMETER[8] = atoi(strtokIndx);
-  strtokIndx = strtok(NULL, ", ");
-  PARAMETER[9] = atoi(strtokIndx);
+  if (RxState == 1) {
+    COMMAND[RxTokenLength < sizeof(COMMAND) ? RxTokenLength : sizeof(COMMAND) - 1] = '\0';
+    RxState = 2;
+  } else if (ParameterCount < 10) {
+    ParameterCount++;
+  }
+  RxTokenLength = 0;
+  RxNegative = false;
+  RxConverting = true;
 }
 
 void AdvancedSerial::setInitialIntervalSettings(bool loggingActivated, unsigned long loggingInterval_ms) {
@@ -261,284 +670,1588 @@ void AdvancedSerial::setInitialIntervalSettings(bool loggingActivated, unsigned
   }
 }
 
-void AdvancedSerial::TransmitSymbols(unsigned long msg_id, bool send_eol) {
-  SerialRef->write("#ASI:");
-  byte msg_key = 0xB0;
-  SerialRef->write(msg_key);
-  SerialRef->write(":");
-  ulngCvt.val = msg_id;
-  SerialRef->write(ulngCvt.bval, 4);
-  SerialRef->write(":");
-
-  for (int i = 0; i < signalCount; i++) {
-    intCvt.val = i;
-    SerialRef->write(intCvt.bval, 2);
-    LoggedSignal sym = Signals[i];
-    SerialRef->print(sym.Name);
-    SerialRef->write('\0');
-
-    switch (sym.Type) {
-      case (asi_bool): {
-          SerialRef->write(0x0);
-          break;
-        }
-      case (asi_byte): {
-          SerialRef->write(0x1);
-          break;
-        }
-      case (asi_short): {
-          SerialRef->write(0x2);
-          break;
-        }
-      case (asi_int): {
-          SerialRef->write(0x3);
-          break;
-        }
-      case (asi_uint): {
-          SerialRef->write(0x4);
-          break;
-        }
-      case (asi_long): {
-          SerialRef->write(0x5);
-          break;
-        }
-      case (asi_ulong): {
-          SerialRef->write(0x6);
-          break;
-        }
-      case (asi_float): {
-          SerialRef->write(0x7);
-          break;
-        }
-      case (asi_double): {
-          SerialRef->write(0x8);
-          break;
-        }
+bool AdvancedSerial::setAsyncTransmit(unsigned int bufferSize, bool writeAll) {
+  if (bufferSize < 2) return setAsyncTransmit((byte *)0, 0); //0: back to blocking transmit
+
+  byte * buffer = new byte[bufferSize];
+  if (buffer == 0 || !setAsyncTransmit(buffer, bufferSize, writeAll)) return false;
+  TxBufferOwned = true;
+  return true;
+}
+
+bool AdvancedSerial::setAsyncTransmit(byte * buffer, unsigned int bufferSize, bool writeAll) {
+  if (TxBufferOwned) delete[] TxBuffer;
+  TxBuffer = 0;
+  TxBufferSize = 0;
+  TxBufferOwned = false;
+  TxHead = TxTail = TxWriteHead = 0;
+
+  if (buffer == 0 || bufferSize < 2) return bufferSize == 0;
+
+  TxBuffer = buffer;
+  TxBufferSize = bufferSize;
+  TxWriteAll = writeAll;
+  return true;
+}
+
+#if ASI_STATS
+void AdvancedSerial::addTiming(ASITimer & timer, unsigned long value) {
+  if (timer.Count == 0 || value < timer.Min) timer.Min = value;
+  if (value > timer.Max) timer.Max = value;
+  timer.Total += value;
+  timer.Count++;
+}
+
+const ASIStats & AdvancedSerial::getStats() {
+  return Stats;
+}
+
+void AdvancedSerial::resetStats() {
+  memset(&Stats, 0, sizeof(Stats));
+}
+
+void AdvancedSerial::TransmitStats(unsigned long msg_id) {
+  //B6: see <STATS> in AdvancedSerial.h
+  unsigned long values[8 + 4 * 4];
+  values[0] = Stats.BytesSent;
+  values[1] = Stats.FramesSent;
+  values[2] = TxFramesDropped;
+  values[3] = Stats.CommandsReceived;
+  values[4] = CommandsTruncated;
+  values[5] = SamplesDropped;
+  values[6] = Stats.WireRetries;
+  values[7] = Stats.WireEmpty;
+  const ASITimer * timers[4] = { &Stats.Transmit_us, &Stats.Command_us, &Stats.Wire_us, &Stats.IntervalLate_ms };
+  for (byte t = 0; t < 4; t++) {
+    unsigned long * v = values + 8 + 4 * t;
+    v[0] = timers[t]->Count;
+    v[1] = timers[t]->Min;
+    v[2] = timers[t]->Max;
+    v[3] = timers[t]->Count ? timers[t]->Total / timers[t]->Count : 0;
+  }
+
+  byte frame[ASI_HEADER_LENGTH + sizeof(values) + ASI_TRAILER_LENGTH];
+  byte * p = packHeader(frame, 0xB6, msg_id);
+  for (byte i = 0; i < 8 + 4 * 4; i++) {
+    ulngCvt.val = values[i];
+    memcpy(p, ulngCvt.bval, 4);
+    p += 4;
+  }
+  p = packTrailer(p);
+  txBeginFrame();
+  txWrite(frame, p - frame);
+  txEndFrame();
+}
+
+void AdvancedSerial::cmdStats(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  //<LOGGING_STATS,MSGID_0,..,3,RESET>
+  asi->TransmitStats(messageID(parameter));
+  if (parameter[4] == 1) asi->resetStats();
+}
+#endif
+
+unsigned long AdvancedSerial::getDroppedFrames() {
+  return TxFramesDropped;
+}
+
+void AdvancedSerial::update() {
+  txDrain();
+  if (SamplePeriod_us > 0 && (long)(micros() - SampleNextDue_us) >= 0) {
+    SampleNextDue_us += SamplePeriod_us;
+    if ((long)(micros() - SampleNextDue_us) >= 0) SampleNextDue_us = micros() + SamplePeriod_us; //fell behind
+    sample();
+  }
+  if (TriggerState == asi_trigger_captured) transmitSamples(0xB7, TriggerMessageID, true, 0);
+  if (LOGGING_MODE == 1 && PollInterval_ms > 0) {
+    ASI_TIMER_START(start_us);
+    pollStep();
+    ASI_TIMER_STOP(Wire_us, start_us);
+  }
+  if (WireSyncRequested) {
+    //Sync command from the master (WireMode 4), published here instead of in the Wire handler
+    if (publishSnapshot()) WireSyncRequested = false;
+  }
+}
+
+void AdvancedSerial::txBeginFrame() {
+  //Frames may be nested, e.g. WireTransmitData() continues the frame started by TransmitData()
+  if (TxFrameDepth++ > 0) return;
+#if ASI_STATS
+  TxFrameStart_us = micros();
+#endif
+  TxFrameBytes = 0;
+  TxWriteHead = TxHead;
+  TxFrameOverflow = false;
+  FrameCrc = 0xFFFF;
+  FramePayloadLength = 0;
+  CobsCode = 0;
+  CobsLength = 1; //code byte of the first block
+}
+
+void AdvancedSerial::txWrite(const byte * data, unsigned int length) {
+  if (CobsBuffer == 0) {
+    txWriteRaw(data, length);
+    return;
+  }
+  //Framed: CRC and length cover everything written between txBeginFrame() and txEndFrame()
+  uint16_t crc = FrameCrc;
+  for (unsigned int i = 0; i < length; i++) crc = crc16(crc, data[i]);
+  FrameCrc = crc;
+  FramePayloadLength += length;
+  cobsWrite(data, length);
+}
+
+void AdvancedSerial::txWriteRaw(const byte * data, unsigned int length) {
+  TxFrameBytes += length;
+  if (TxBuffer == 0) {
+    SerialRef->write(data, length);
+    return;
+  }
+  if (TxFrameOverflow) return;
+
+  unsigned int used = (TxWriteHead + TxBufferSize - TxTail) % TxBufferSize;
+  if (length > TxBufferSize - 1 - used) {
+    TxFrameOverflow = true; //frame is dropped as a whole in txEndFrame()
+    return;
+  }
+  while (length > 0) {
+    unsigned int chunk = TxBufferSize - TxWriteHead;
+    if (chunk > length) chunk = length;
+    memcpy(TxBuffer + TxWriteHead, data, chunk);
+    TxWriteHead += chunk;
+    if (TxWriteHead == TxBufferSize) TxWriteHead = 0;
+    data += chunk;
+    length -= chunk;
+  }
+}
+
+void AdvancedSerial::txWrite(byte c) {
+  txWrite(&c, 1);
+}
+
+void AdvancedSerial::txTrailer() {
+  byte trailer[ASI_TRAILER_LENGTH];
+  txWrite(trailer, packTrailer(trailer) - trailer);
+}
+
+bool AdvancedSerial::txEndFrame(bool flush) {
+  //Returns false if the frame was dropped. flush: blocking transmit waits until the frame is sent
+  if (TxFrameDepth == 0 || --TxFrameDepth > 0) return !TxFrameOverflow;
+
+  if (CobsBuffer) {
+    //<LEN><CRC16> close the packet, then the last COBS block and the 0x00 delimiter
+    byte lengthBytes[2] = { lowByte(FramePayloadLength), highByte(FramePayloadLength) };
+    txWrite(lengthBytes, 2);
+    uint16_t crc = FrameCrc;
+    cobsPut(highByte(crc));
+    cobsPut(lowByte(crc));
+    cobsEndBlock();
+    cobsReserve(1);
+    CobsBuffer[CobsLength++] = 0;
+    txWriteRaw(CobsBuffer, CobsLength);
+  }
+
+  if (TxBuffer == 0) {
+    if (flush) SerialRef->flush();
+  } else if (TxFrameOverflow) {
+    TxFramesDropped++;
+  } else {
+    TxHead = TxWriteHead;
+  }
+  if (!TxFrameOverflow) {
+    ASI_STAT_ADD(FramesSent, 1);
+    ASI_STAT_ADD(BytesSent, TxFrameBytes);
+  }
+  ASI_TIMER_STOP(Transmit_us, TxFrameStart_us);
+  if (TxBuffer != 0) txDrain();
+  return !TxFrameOverflow;
+}
+
+void AdvancedSerial::cobsPut(byte c) {
+  cobsWrite(&c, 1);
+}
+
+void AdvancedSerial::cobsWrite(const byte * data, unsigned int length) {
+  //The bytes up to the next zero are copied as one run, at most up to the end of the block
+  while (length > 0) {
+    if (*data != 0) {
+      unsigned int run = 255 - (CobsLength - CobsCode); //room left in the block, at least 1
+      if (run > length) run = length;
+      const byte * zero = (const byte *)memchr(data, 0, run);
+      if (zero != 0) run = zero - data;
+      cobsReserve(run);
+      memcpy(CobsBuffer + CobsLength, data, run);
+      CobsLength += run;
+      data += run;
+      length -= run;
+      if (CobsLength - CobsCode < 255) continue;
+    } else {
+      data++;
+      length--;
     }
+    //A zero or 254 bytes without zero end the block, the next one starts with its code byte
+    cobsEndBlock();
+    cobsReserve(1);
+    CobsCode = CobsLength++;
+  }
+}
+
+void AdvancedSerial::cobsEndBlock() {
+  //Block code: Position of the next zero (block length + 1), 0xFF for a full block without zero
+  CobsBuffer[CobsCode] = CobsLength - CobsCode;
+}
+
+void AdvancedSerial::cobsReserve(unsigned int count) {
+  //Room for count more bytes of the open block: Grows the buffer in 128 byte steps, or hands the
+  //finished blocks over if there is no heap left (a block with its code byte fits the first 256 bytes)
+  if (CobsLength + count <= CobsBufferSize) return;
+  unsigned int size = (CobsLength + count + 127) & ~127U;
+  byte * newBuffer = new byte[size];
+  if (newBuffer != 0) {
+    memcpy(newBuffer, CobsBuffer, CobsLength);
+    delete[] CobsBuffer;
+    CobsBuffer = newBuffer;
+    CobsBufferSize = size;
+    return;
+  }
+  txWriteRaw(CobsBuffer, CobsCode);
+  CobsLength -= CobsCode;
+  memmove(CobsBuffer, CobsBuffer + CobsCode, CobsLength);
+  CobsCode = 0;
+}
+
+#if !defined(__AVR__)
+//CRC of every value of the high byte, for crc16()
+static const uint16_t ASI_CRC16_TABLE[256] PROGMEM = {
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+  0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+  0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+  0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+  0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+  0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+  0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+  0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+  0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+  0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+  0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+  0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+  0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+  0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+  0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+  0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+  0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+  0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+  0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+  0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+  0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+  0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+  0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+  0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+  0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+  0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+  0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+  0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+  0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+  0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+  0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+#endif
+
+uint16_t AdvancedSerial::crc16(uint16_t crc, byte c) {
+  //CRC-16/CCITT-FALSE: Polynomial 0x1021, initial value 0xFFFF (set in txBeginFrame())
+#if defined(__AVR__)
+  return _crc_xmodem_update(crc, c); //same polynomial and bit order, XMODEM only starts at 0
+#else
+  return (crc << 8) ^ pgm_read_word(&ASI_CRC16_TABLE[(crc >> 8) ^ c]);
+#endif
+}
+
+bool AdvancedSerial::setFramedTransmit(bool enable) {
+  if (TxFrameDepth > 0) return false;
+  if (!enable) {
+    delete[] CobsBuffer;
+    CobsBuffer = 0;
+    CobsBufferSize = 0;
+    return true;
+  }
+  //Fits a full block with its code byte, grows to the longest packet sent
+  if (CobsBuffer == 0) {
+    CobsBuffer = new byte[256];
+    CobsBufferSize = CobsBuffer != 0 ? 256 : 0;
+  }
+  return CobsBuffer != 0;
+}
+
+void AdvancedSerial::cmdFraming(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  asi->setFramedTransmit(parameter[0] != 0);
+}
+
+unsigned int AdvancedSerial::txFrameLength(unsigned int length) {
+  //Bytes a frame with length bytes between txBeginFrame() and txEndFrame() takes in the ring,
+  //framed: <LEN><CRC16>, a code byte per 254 bytes, the last code byte and the delimiter at most
+  if (CobsBuffer == 0) return length;
+  length += 4;
+  return length + length / 254 + 2;
+}
+
+unsigned int AdvancedSerial::txFree() {
+  //Free bytes in the ring outside of a frame, one stays empty to tell a full ring from an empty one
+  return TxBufferSize - 1 - (TxHead + TxBufferSize - TxTail) % TxBufferSize;
+}
+
+void AdvancedSerial::txDrain() {
+  //Only hand over as many bytes as the UART can take without blocking
+  while (TxTail != TxHead) {
+    //TxWriteAll: Stream without availableForWrite(), its write() blocks or takes all
+    int room = TxWriteAll ? (int)TxBufferSize : SerialRef->availableForWrite();
+    if (room <= 0) return;
+
+    unsigned int chunk = (TxHead > TxTail ? TxHead : TxBufferSize) - TxTail;
+    if (chunk > (unsigned int)room) chunk = room;
+    SerialRef->write(TxBuffer + TxTail, chunk);
+    TxTail += chunk;
+    if (TxTail == TxBufferSize) TxTail = 0;
+  }
+}
+
+void AdvancedSerial::TransmitSymbols(unsigned long msg_id, bool send_eol) {
+  txBeginFrame();
+
+  byte header[ASI_HEADER_LENGTH];
+  txWrite(header, packHeader(header, 0xB0, msg_id) - header);
+
+  for (unsigned int i = 0; i < signalCount; i++) {
+    const LoggedSignal & sym = Signals[i];
+    char name[64];
+    byte nameLength = copyName(name, sizeof(name), sym);
+    txWrite(lowByte(i));
+    txWrite(highByte(i));
+    txWrite((const byte *)name, nameLength + 1); //Name + Null Terminator
+    txWrite(ASI_TYPE_CODE[sym.Type]);
+    byte metadata[ASI_MAX_METADATA_LENGTH];
+    txWrite(metadata, packMetadata(metadata, sym));
   }
   if (send_eol) {
-    SerialRef->write("ENDOFASI");
-    SerialRef->write("\r\n");
+    txTrailer();
   }
 
-  SerialRef->flush();
+  txEndFrame();
 }
 
-void AdvancedSerial::TransmitData(unsigned long msg_id, bool send_eol) {
+bool AdvancedSerial::reserveFrameBuffer() {
+  unsigned int length = DataFrameLength + (FrameTimestamps ? ASI_EXTENDED_HEADER_LENGTH : 0);
+  if (StaticStorage) return length <= FrameBufferSize;
+  return reserveBuffer(FrameBuffer, FrameBufferSize, length);
+}
+
+bool AdvancedSerial::reserveBuffer(byte *& buffer, unsigned int & bufferSize, unsigned int length) {
+  if (length <= bufferSize) return true;
+
+  //Grow in 32 byte steps, so adding a few signals later does not reallocate every time
+  length = (length + 31) & ~31U;
+  byte * newBuffer = new byte[length];
+  if (newBuffer == 0) return false;
 
-  SerialRef->write("#ASI:");
-  byte msg_key = 0xB1;
-  SerialRef->write(msg_key);
-  SerialRef->write(":");
+  delete[] buffer;
+  buffer = newBuffer;
+  bufferSize = length;
+  return true;
+}
+
+byte * AdvancedSerial::packHeader(byte * dst, byte msg_key, unsigned long msg_id) {
   ulngCvt.val = msg_id;
-  SerialRef->write(ulngCvt.bval, 4);
-  SerialRef->write(":");
-
-  int bytecount = 22 + signalCount * 2;
-  for (int i = 0; i < signalCount; i++) {
-    intCvt.val = i;
-    SerialRef->write(intCvt.bval, 2);
-    LoggedSignal sym = Signals[i];
-    switch (sym.Type) {
-      case (asi_bool): {
-          boolCvt.val = *((bool*)sym.addr);
-          SerialRef->write(boolCvt.bval, 1);
-          bytecount += 1;
-        } break;
-      case (asi_byte): {
-          SerialRef->write(*((byte*)sym.addr));
-          bytecount += 1;
-        } break;
-      case (asi_short): {
-          shortCvt.val = *((short*)sym.addr);
-          SerialRef->write(shortCvt.bval, 2);
-          bytecount += 2;
-        } break;
-      case (asi_int): {
-          intCvt.val = *((int*)sym.addr);
-          SerialRef->write(intCvt.bval, 2);
-          bytecount += 2;
-        } break;
-      case (asi_uint): {
-          uintCvt.val = *((unsigned int*)sym.addr);
-          SerialRef->write(uintCvt.bval, 2);
-          bytecount += 2;
-        } break;
-      case (asi_long): {
-          lngCvt.val = *((long*)sym.addr);
-          SerialRef->write(lngCvt.bval, 4);
-          bytecount += 4;
-        } break;
-      case (asi_ulong): {
-          ulngCvt.val = *((unsigned long*)sym.addr);
-          SerialRef->write(ulngCvt.bval, 4);
-          bytecount += 4;
-        } break;
-      case (asi_float): {
-          fltCvt.val = *((float*)sym.addr);
-          SerialRef->write(fltCvt.bval, 4);
-          bytecount += 4;
-        } break;
-      case (asi_double): {
-          dblCvt.val = *((double*)sym.addr);
-          //Serial.print("Double!");
-          SerialRef->write(dblCvt.bval, 8);
-          bytecount += 8;
-        } break;
+  if (CobsBuffer) {
+    //Framed: <MSGKEY><MSGID> only
+    dst[0] = msg_key;
+    memcpy(dst + 1, ulngCvt.bval, 4);
+    return dst + ASI_FRAMED_HEADER_LENGTH;
+  }
+
+  memcpy(dst, "#ASI:", 5);
+  dst[5] = msg_key;
+  dst[6] = ':';
+  memcpy(dst + 7, ulngCvt.bval, 4);
+  dst[11] = ':';
+  return dst + ASI_HEADER_LENGTH;
+}
+
+byte * AdvancedSerial::packDataHeader(byte * dst, byte msg_key, unsigned long msg_id) {
+  //Data frames (B1, B2, B5) carry <FrameCounter><Timestamp><SymbolHash> after the header once the host asked for it
+  dst = packHeader(dst, msg_key, msg_id);
+  if (!FrameTimestamps) return dst;
+
+  unsigned long timestamp = micros();
+  uint32_t hash = getSymbolHash();
+  memcpy(dst, &FrameCounter, 4);
+  memcpy(dst + 4, &timestamp, ASI_TIMESTAMP_LENGTH);
+  memcpy(dst + 8, &hash, 4);
+  FrameCounter++;
+  return dst + ASI_EXTENDED_HEADER_LENGTH;
+}
+
+void AdvancedSerial::setFrameTimestamps(bool enable) {
+  FrameTimestamps = enable;
+  FrameCounter = 0;
+}
+
+uint32_t AdvancedSerial::getSymbolHash() {
+  //Own symbols, in master mode extended by every known slave, so a changed or new slave changes it too
+  uint32_t hash = SymbolHash;
+  if (LOGGING_MODE != 1) return hash;
+  for (byte s = 0; s < SlaveCount; s++) {
+    byte slave[7] = { Slaves[s].Address, lowByte(Slaves[s].SignalCount), highByte(Slaves[s].SignalCount) };
+    memcpy(slave + 3, &Slaves[s].SymbolHash, 4);
+    for (byte i = 0; i < sizeof(slave); i++) hash = (hash ^ slave[i]) * 16777619UL;
+  }
+  return hash;
+}
+
+void AdvancedSerial::TransmitSymbolHash(unsigned long msg_id) {
+  //B9: <SymbolHash><N>, N: number of signals incl. the ones of the known slaves
+  if (LOGGING_MODE == 1 && !SlavesDiscovered) discoverSlaves(1, 127);
+  uint32_t hash = getSymbolHash();
+  unsigned int count = signalCount;
+  if (LOGGING_MODE == 1) {
+    for (byte s = 0; s < SlaveCount; s++) count += Slaves[s].SignalCount;
+  }
+
+  byte frame[ASI_HEADER_LENGTH + 6 + ASI_TRAILER_LENGTH];
+  byte * p = packHeader(frame, 0xB9, msg_id);
+  memcpy(p, &hash, 4);
+  p[4] = lowByte(count);
+  p[5] = highByte(count);
+  p = packTrailer(p + 6);
+  txBeginFrame();
+  txWrite(frame, p - frame);
+  txEndFrame();
+}
+
+void AdvancedSerial::cmdGetHash(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  asi->TransmitSymbolHash(messageID(parameter));
+}
+
+void AdvancedSerial::cmdTimestamps(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  asi->setFrameTimestamps(parameter[0] != 0);
+}
+
+byte * AdvancedSerial::packTrailer(byte * dst) {
+  if (CobsBuffer) return dst; //Framed: txEndFrame() ends the frame
+  memcpy(dst, "ENDOFASI\r\n", ASI_TRAILER_LENGTH);
+  return dst + ASI_TRAILER_LENGTH;
+}
+
+unsigned int AdvancedSerial::packValue(byte * dst, const LoggedSignal & sym) {
+  //Plain copy without shared state, so sample() may call it from an ISR.
+  //Values are little endian: wider variables (e.g. 32 bit int) are cut to the frame size,
+  //narrower ones (e.g. 32 bit double on AVR) are padded with 0
+  byte size = ASI_TYPE_SIZE[sym.Type];
+  byte native = ASI_NATIVE_SIZE[sym.Type];
+  if (sym.Type == asi_scaled8 || sym.Type == asi_scaled16) {
+    //Quantized to the nearest raw value, limited to the range of int8/int16
+    const ASIScaledValue * scaled = (const ASIScaledValue *)sym.addr;
+    float raw = (signalValue(sym) - scaled->Offset) / scaled->Scale;
+    long limit = (size == 1) ? 127 : 32767;
+    long quantized = (raw >= limit) ? limit : (raw <= -limit - 1) ? -limit - 1 : (long)(raw < 0 ? raw - 0.5f : raw + 0.5f);
+    dst[0] = lowByte(quantized);
+    if (size == 2) dst[1] = highByte(quantized);
+  } else if (sym.Type == asi_block) {
+    //One copy per field if the elements have their frame size, else element by element
+    const ASIBlockValue * block = (const ASIBlockValue *)sym.addr;
+    byte * p = dst;
+    for (byte f = 0; f < block->FieldCount; f++) {
+      const ASIField & field = block->field(f);
+      const byte * src = (const byte *)block->addr + field.Offset;
+      byte elementSize = ASI_TYPE_SIZE[field.Type];
+      byte elementNative = ASI_NATIVE_SIZE[field.Type];
+      if (elementSize == elementNative) {
+        memcpy(p, src, field.Count * elementSize);
+        p += field.Count * elementSize;
+        continue;
+      }
+      for (unsigned int e = 0; e < field.Count; e++) {
+        LoggedSignal element = { 0, (void *)(src + e * elementNative), field.Type, 0 };
+        p += packValue(p, element);
+      }
     }
+    return p - dst;
+  } else if (native >= size) {
+    memcpy(dst, sym.addr, size);
+  } else {
+    memcpy(dst, sym.addr, native);
+    memset(dst + native, 0, size - native);
   }
+  return size;
+}
 
-  if (send_eol) {
-    SerialRef->write("ENDOFASI");
-    SerialRef->write("\r\n");
+unsigned int AdvancedSerial::valueLength() {
+  //Value bytes of all signals, without the IDs
+  return DataFrameLength - ASI_HEADER_LENGTH - ASI_TRAILER_LENGTH - signalCount * ASI_ID_LENGTH;
+}
+
+void AdvancedSerial::TransmitData(unsigned long msg_id, bool send_eol) {
+
+  //The whole frame is assembled in FrameBuffer and handed to the stream with a single write
+  if (!reserveFrameBuffer()) return;
+
+  byte * entries = packDataHeader(FrameBuffer, 0xB1, msg_id);
+  byte * p = entries;
+
+  for (unsigned int i = 0; i < signalCount; i++) {
+    *p++ = lowByte(i);
+    *p++ = highByte(i);
+    p += packValue(p, Signals[i]);
   }
+  byte * end = p;
+
+  if (send_eol) p = packTrailer(p);
 
-  SerialRef->flush();
+  txBeginFrame();
+  bool nested = TxFrameDepth > 1; //sent or dropped with the outer frame
+  txWrite(FrameBuffer, p - FrameBuffer);
+  bool sent = txEndFrame();
+  updateDeltaShadow(entries, end, sent && !nested);
 }
 
+void AdvancedSerial::updateDeltaShadow(const byte * entries, const byte * end, bool sent) {
+  //The host takes a B1 frame as the state of the signals in it, so B2/B5 frames have to
+  //continue from these values. entries: <SymbolID><DATA> in ascending ID order
+  if (DeltaShadow == 0) return; //the first B2/B5 frame is a keyframe
+  if (!sent || DeltaShadowSize < valueLength()) {
+    DeltaKeyframeDue = true;
+    return;
+  }
 
-void AdvancedSerial::WireTransmitSymbols(unsigned long msg_id, bool send_eol) {
+  byte * shadow = DeltaShadow;
+  unsigned int next = 0;
+  while (entries < end) {
+    unsigned int id = entries[0] | (entries[1] << 8);
+    entries += ASI_ID_LENGTH;
+    for (; next < id; next++) shadow += signalSize(Signals[next]);
+    unsigned int size = signalSize(Signals[id]);
+    memcpy(shadow, entries, size);
+    entries += size;
+    shadow += size;
+    next++;
+  }
+}
 
-  this->TransmitSymbols(msg_id, false);
 
-  int signalcount = 0;
+void AdvancedSerial::setDeltaFrames(unsigned int keyframeInterval) {
+  DeltaKeyframeInterval = keyframeInterval;
+  DeltaFramesSinceKeyframe = 0;
+  DeltaKeyframeDue = true;
+  CompressedFrames = false;
+}
+
+void AdvancedSerial::setCompressedFrames(unsigned int keyframeInterval) {
+  setDeltaFrames(keyframeInterval);
+  CompressedFrames = true;
+}
+
+void AdvancedSerial::TransmitDeltaData(unsigned long msg_id, bool send_eol) {
+  transmitDelta(msg_id, send_eol, false);
+}
 
-  for (int slaveindex = 0; slaveindex <= 127; slaveindex++) { //Cycle through slaves
-    byte transmissionIsSuccess = false;
+void AdvancedSerial::TransmitCompressedData(unsigned long msg_id, bool send_eol) {
+  transmitDelta(msg_id, send_eol, true);
+}
 
-    for (byte retries = 0; retries < 4; retries++) {
-      Wire.beginTransmission(slaveindex);
-      Wire.write(0);
-      transmissionIsSuccess = Wire.endTransmission();
-      if (transmissionIsSuccess == 0) break; //0: success
+void AdvancedSerial::transmitDelta(unsigned long msg_id, bool send_eol, bool compressed) {
+
+  //Last transmitted value bytes of all signals, in signal order
+  if (!reserveFrameBuffer()) return;
+  if (!reserveBuffer(DeltaShadow, DeltaShadowSize, valueLength())) return;
+
+  //Interval 0 (LOGGING_GETDELTA without LOGGING_SETDELTA): Only the first frame or a resync is a keyframe
+  if (DeltaKeyframeInterval > 0 && DeltaFramesSinceKeyframe >= DeltaKeyframeInterval) DeltaKeyframeDue = true;
+  bool keyframe = DeltaKeyframeDue;
+
+  //Keyframes are plain B1 frames, so the host can resync from any of them
+  byte msg_key = keyframe ? 0xB1 : (compressed ? 0xB5 : 0xB2);
+  byte * p = packDataHeader(FrameBuffer, msg_key, msg_id);
+  byte * shadow = DeltaShadow;
+
+  for (unsigned int i = 0; i < signalCount; i++) {
+    if (compressed && !keyframe) {
+      //B5: No IDs, every signal encoded against its last sent value
+      if (Signals[i].Type == asi_block) {
+        //Blocks as plain bytes
+        unsigned int size = packValue(p, Signals[i]);
+        memcpy(shadow, p, size);
+        p += size;
+        shadow += size;
+        continue;
+      }
+      byte value[8];
+      byte size = packValue(value, Signals[i]);
+      p += packCompressed(p, value, shadow, Signals[i].Type);
+      memcpy(shadow, value, size);
+      shadow += size;
+      continue;
     }
 
-    if (transmissionIsSuccess == 0) {
+    unsigned int size = packValue(p + ASI_ID_LENGTH, Signals[i]);
+    if (keyframe || memcmp(p + ASI_ID_LENGTH, shadow, size) != 0) {
+      memcpy(shadow, p + ASI_ID_LENGTH, size);
+      *p++ = lowByte(i);
+      *p++ = highByte(i);
+      p += size;
+    }
+    shadow += size;
+  }
 
-      SLAVE_FOUND[slaveindex] = false;
-      bool eolist_found = false;
+  if (send_eol) p = packTrailer(p);
 
-      for (int i = 0; i < 1000; i++) {
-        byte receivedBytes = Wire.requestFrom(slaveindex, 32);    // request 32 bytes from slave device
-        if (receivedBytes < 2) continue; //try again
+  txBeginFrame();
+  txWrite(FrameBuffer, p - FrameBuffer);
+  bool sent = txEndFrame();
 
-        bool eosignal_found = false;
-        if (i == 0) {
-          //Expecting response 0xAA from slave -> Slave found
-          char c = Wire.read(); // receive a byte as character
+  //The host did not get the values the shadow now holds, resync with a keyframe
+  DeltaKeyframeDue = !sent;
+  DeltaFramesSinceKeyframe = keyframe ? 1 : DeltaFramesSinceKeyframe + 1;
+}
 
-          if (c == char(0xAA)) {
-            SLAVE_FOUND[slaveindex] = true;
+byte AdvancedSerial::packCompressed(byte * dst, const byte * value, const byte * previous, byte type) {
+  byte size = ASI_TYPE_SIZE[type];
+
+  if (type == asi_float || type == asi_double) {
+    //XOR with the previous value: <(LeadingZeroBytes << 4) | N> + the N meaningful bytes (little endian)
+    byte xored[8];
+    byte lead = 0;
+    byte trail = 0;
+    for (byte i = 0; i < size; i++) xored[i] = value[i] ^ previous[i];
+    while (lead < size && xored[size - 1 - lead] == 0) lead++;
+    if (lead == size) {
+      dst[0] = 0;
+      return 1;
+    }
+    while (xored[trail] == 0) trail++;
+    byte length = size - lead - trail;
+    dst[0] = (lead << 4) | length;
+    memcpy(dst + 1, xored + trail, length);
+    return length + 1;
+  }
 
-          } else {
-            SLAVE_FOUND[slaveindex] = false;
-            break; //exit loop
-          }
-        }
+  //Integers: Difference to the previous value in the width of the type, zigzag encoded varint
+  uint32_t current = 0;
+  uint32_t last = 0;
+  for (byte i = 0; i < size; i++) {
+    current |= (uint32_t)value[i] << (8 * i);
+    last |= (uint32_t)previous[i] << (8 * i);
+  }
+  byte shift = 32 - 8 * size;
+  int32_t delta = (int32_t)((current - last) << shift) >> shift; //sign extend from the type width
+  uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+
+  byte length = 0;
+  do {
+    byte b = zigzag & 0x7F;
+    zigzag >>= 7;
+    dst[length++] = zigzag ? (b | 0x80) : b;
+  } while (zigzag);
+  return length;
+}
 
-        if (SLAVE_FOUND[slaveindex]) {
-          //Signal Key
-          Serial.write(lowByte(signalCount + signalcount));
-          Serial.write(highByte(signalCount + signalcount));
-
-          int charsToRead = 32;
-          if (i == 0) charsToRead = 31;
-          for (int symbolchar = 0; symbolchar <= charsToRead - 1; symbolchar++) { // slave may send less than requested
-            //Signal Name + \0 + Signal Type
-            char c = Wire.read(); // receive a byte as character
-            if (c == char(0x0D)) {
-              eosignal_found = true; //"\r"
-              signalcount += 1;
-            }
-            if (c == char(0x0A)) eolist_found = true; //"\n"
-            if (eosignal_found != true && eolist_found != true) Serial.print(c);
-          }
-          if (eolist_found) break;
-        }
+void AdvancedSerial::cmdSetCompressed(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  unsigned int keyframeInterval = parameter[0] < 0 ? 0 : parameter[0];
+  asi->setCompressedFrames(keyframeInterval);
+}
+
+void AdvancedSerial::cmdGetCompressed(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  if (asi->LOGGING_MODE == 0 || asi->LOGGING_MODE == 2) {
+    asi->TransmitCompressedData(messageID(parameter), true);
+  } else if (asi->LOGGING_MODE == 1) {
+    asi->WireTransmitData(messageID(parameter), true);
+  }
+}
+
+
+bool AdvancedSerial::subscribeSignal(unsigned int SymbolID, unsigned long period_ms) {
+  if (SymbolID >= signalCount || period_ms == 0) return false;
+
+  if (SubscriptionGroup == 0) {
+    SubscriptionGroup = new byte[maxSignalCount];
+    if (SubscriptionGroup == 0) return false;
+    memset(SubscriptionGroup, ASI_NO_RATE_GROUP, maxSignalCount);
+  }
+
+  //Signals with the same period share a rate group
+  byte group = ASI_NO_RATE_GROUP;
+  for (byte g = 0; g < ASI_MAX_RATE_GROUPS; g++) {
+    if (RateGroups[g].Period_ms == period_ms) {
+      group = g;
+      break;
+    }
+    if (RateGroups[g].Period_ms == 0 && group == ASI_NO_RATE_GROUP) group = g;
+  }
+  if (group == ASI_NO_RATE_GROUP) return false;
+
+  if (RateGroups[group].Period_ms == 0) {
+    RateGroups[group].Period_ms = period_ms;
+    RateGroups[group].NextDue_ms = millis();
+    RateGroupCount++;
+  }
+  byte previous = SubscriptionGroup[SymbolID];
+  SubscriptionGroup[SymbolID] = group;
+  if (previous != ASI_NO_RATE_GROUP && previous != group) releaseRateGroups();
+  return true;
+}
+
+void AdvancedSerial::unsubscribeSignal(unsigned int SymbolID) {
+  if (SubscriptionGroup == 0 || SymbolID >= signalCount) return;
+  SubscriptionGroup[SymbolID] = ASI_NO_RATE_GROUP;
+  releaseRateGroups();
+}
+
+void AdvancedSerial::unsubscribeAll() {
+  if (SubscriptionGroup) memset(SubscriptionGroup, ASI_NO_RATE_GROUP, maxSignalCount);
+  memset(RateGroups, 0, sizeof(RateGroups));
+  RateGroupCount = 0;
+}
+
+void AdvancedSerial::releaseRateGroups() {
+  //Frees the rate groups no signal is subscribed to anymore
+  byte used = 0;
+  for (unsigned int i = 0; i < signalCount; i++) {
+    if (SubscriptionGroup[i] != ASI_NO_RATE_GROUP) used |= 1 << SubscriptionGroup[i];
+  }
+  RateGroupCount = 0;
+  for (byte g = 0; g < ASI_MAX_RATE_GROUPS; g++) {
+    if (!(used & (1 << g))) RateGroups[g].Period_ms = 0;
+    if (RateGroups[g].Period_ms != 0) RateGroupCount++;
+  }
+}
+
+void AdvancedSerial::TransmitScheduledData(unsigned long msg_id, bool send_eol) {
+
+  //Collect the rate groups which are due in this tick
+  unsigned long now = millis();
+  byte dueGroups = 0;
+  for (byte g = 0; g < ASI_MAX_RATE_GROUPS; g++) {
+    ASIRateGroup & group = RateGroups[g];
+    if (group.Period_ms == 0 || (long)(now - group.NextDue_ms) < 0) continue;
+    dueGroups |= 1 << g;
+    ASI_TIMING(IntervalLate_ms, now - group.NextDue_ms);
+    group.NextDue_ms += group.Period_ms;
+    if ((long)(now - group.NextDue_ms) >= 0) group.NextDue_ms = now + group.Period_ms; //fell behind, skip missed ticks
+  }
+  if (dueGroups == 0) return;
+
+  //One B1 frame with all due signals
+  if (!reserveFrameBuffer()) return;
+
+  byte * entries = packDataHeader(FrameBuffer, 0xB1, msg_id);
+  byte * p = entries;
+
+  for (unsigned int i = 0; i < signalCount; i++) {
+    byte group = SubscriptionGroup[i];
+    if (group == ASI_NO_RATE_GROUP || !(dueGroups & (1 << group))) continue;
+    *p++ = lowByte(i);
+    *p++ = highByte(i);
+    p += packValue(p, Signals[i]);
+  }
+  byte * end = p;
+
+  if (send_eol) p = packTrailer(p);
+
+  txBeginFrame();
+  txWrite(FrameBuffer, p - FrameBuffer);
+  updateDeltaShadow(entries, end, txEndFrame());
+}
+
+
+bool AdvancedSerial::setAggregateFrames(bool enable) {
+  AggregateFrames = enable;
+  AggregateCount = 0;
+  return !enable || reserveAggregates();
+}
+
+bool AdvancedSerial::reserveAggregates() {
+  return reserveBuffer(Aggregates, AggregatesSize, signalCount * 3 * sizeof(float));
+}
+
+void AdvancedSerial::accumulate() {
+  //Cheap enough for the fast loop, but not for an ISR (not atomic against TransmitAggregates())
+  if (!reserveAggregates()) return;
+  float * a = (float *)Aggregates;
+  for (unsigned int i = 0; i < signalCount; i++, a += 3) {
+    float value = signalValue(Signals[i]);
+    if (AggregateCount == 0) {
+      a[0] = value;
+      a[1] = value;
+      a[2] = value;
+      continue;
+    }
+    if (value < a[0]) a[0] = value;
+    if (value > a[1]) a[1] = value;
+    a[2] += value;
+  }
+  AggregateCount++;
+}
+
+void AdvancedSerial::TransmitAggregates(unsigned long msg_id, bool send_eol) {
+  //B8: <COUNT>, N x <SymbolID><MIN><MAX><MEAN>, then the aggregates start over
+  if (!reserveAggregates()) return;
+  if (AggregateCount == 0) {
+    accumulate(); //only the current values
+    AggregateCount = 0;
+  }
+
+  byte header[ASI_HEADER_LENGTH + 4];
+  byte * p = packHeader(header, 0xB8, msg_id);
+  memcpy(p, &AggregateCount, 4);
+  p += 4;
+  txBeginFrame();
+  txWrite(header, p - header);
+
+  const float * a = (const float *)Aggregates;
+  for (unsigned int i = 0; i < signalCount; i++, a += 3) {
+    float mean = AggregateCount > 0 ? a[2] / AggregateCount : a[2];
+    byte item[ASI_ID_LENGTH + 3 * sizeof(float)];
+    item[0] = lowByte(i);
+    item[1] = highByte(i);
+    memcpy(item + 2, a, 2 * sizeof(float));
+    memcpy(item + 2 + 2 * sizeof(float), &mean, sizeof(float));
+    txWrite(item, sizeof(item));
+  }
+  if (send_eol) txTrailer();
+  txEndFrame();
+  AggregateCount = 0;
+}
+
+void AdvancedSerial::cmdSetAggregate(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  asi->setAggregateFrames(parameter[0] == 1);
+}
+
+void AdvancedSerial::cmdGetAggregate(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  asi->TransmitAggregates(messageID(parameter), true);
+}
+
+bool AdvancedSerial::setSampleBuffer(unsigned int sampleCount) {
+  if (sampleCount == 0) return setSampleBuffer(0, 0);
+
+  unsigned int size = sampleCount * (ASI_TIMESTAMP_LENGTH + valueLength());
+  byte * buffer = new byte[size];
+  if (buffer == 0 || !setSampleBuffer(buffer, size)) return false;
+  SampleBufferOwned = true;
+  return true;
+}
+
+bool AdvancedSerial::setSampleBuffer(byte * buffer, unsigned int bufferSize) {
+  if (SampleBufferOwned) delete[] SampleBuffer;
+  SampleBuffer = buffer;
+  SampleBufferSize = (buffer == 0) ? 0 : bufferSize;
+  SampleBufferOwned = false;
+  resetSampleBuffer();
+  return SampleBuffer == 0 || SampleCapacity > 0;
+}
+
+void AdvancedSerial::resetSampleBuffer() {
+  //The snapshot layout depends on the registered signals, so the buffer starts over when they change
+  noInterrupts();
+  SampleLength = ASI_TIMESTAMP_LENGTH + valueLength();
+  AggregateCount = 0; //the aggregates are per signal as well
+  SampleCapacity = SampleBufferSize / SampleLength;
+  SampleHead = 0;
+  SampleTail = 0;
+  SampleCount = 0;
+  if (TriggerState != asi_trigger_off) TriggerState = asi_trigger_armed; //a running capture starts over
+  TriggerHasLast = false;
+  interrupts();
+}
+
+bool AdvancedSerial::sample() {
+  //May be called from a timer ISR: Only copies the values, a full buffer drops the new snapshot
+  bool capturing = TriggerState == asi_trigger_armed || TriggerState == asi_trigger_post;
+  if (TriggerState == asi_trigger_captured) return false; //window complete, kept until sent
+  if (SampleCount >= SampleCapacity) {
+    if (!capturing || SampleCapacity == 0) {
+      SamplesDropped++;
+      return false;
+    }
+    //Capture: the oldest snapshot makes room
+    SampleTail = (SampleTail + 1 == SampleCapacity) ? 0 : SampleTail + 1;
+    SampleCount--;
+    if (TriggerState == asi_trigger_post) TriggerIndex--;
+  }
+
+  byte * p = SampleBuffer + SampleHead * SampleLength;
+  unsigned long timestamp = micros();
+  memcpy(p, &timestamp, ASI_TIMESTAMP_LENGTH);
+  p += ASI_TIMESTAMP_LENGTH;
+  for (unsigned int i = 0; i < signalCount; i++) {
+    p += packValue(p, Signals[i]);
+  }
+
+  SampleHead = (SampleHead + 1 == SampleCapacity) ? 0 : SampleHead + 1;
+  SampleCount++;
+
+  if (TriggerState == asi_trigger_armed && checkTrigger()) {
+    //Keep up to TriggerPre snapshots before the trigger, fill the rest of the buffer behind it
+    TriggerIndex = SampleCount - 1;
+    unsigned int pre = TriggerIndex < TriggerPre ? TriggerIndex : TriggerPre;
+    TriggerPostRemaining = SampleCapacity - 1 - pre;
+    TriggerState = asi_trigger_post;
+    if (TriggerPostRemaining == 0) TriggerState = asi_trigger_captured;
+  } else if (TriggerState == asi_trigger_post) {
+    if (--TriggerPostRemaining == 0) TriggerState = asi_trigger_captured;
+  }
+  if (TriggerState == asi_trigger_captured) {
+    //Drop what is older than the pre-trigger part
+    unsigned int excess = TriggerIndex > TriggerPre ? TriggerIndex - TriggerPre : 0;
+    SampleTail = (SampleTail + excess) % SampleCapacity;
+    SampleCount -= excess;
+    TriggerIndex -= excess;
+  }
+  return true;
+}
+
+bool AdvancedSerial::checkTrigger() {
+  //Called by sample() with the newest snapshot stored
+  if (TriggerPredicate) return TriggerPredicate(this);
+  if (TriggerSignal >= signalCount) return false;
+
+  float value = signalValue(Signals[TriggerSignal]);
+  bool fired = false;
+  if (TriggerHasLast) {
+    if ((TriggerEdge & ASI_TRIGGER_RISING) && TriggerLastValue < TriggerThreshold && value >= TriggerThreshold) fired = true;
+    if ((TriggerEdge & ASI_TRIGGER_FALLING) && TriggerLastValue > TriggerThreshold && value <= TriggerThreshold) fired = true;
+  }
+  TriggerLastValue = value;
+  TriggerHasLast = true;
+  return fired;
+}
+
+float AdvancedSerial::signalValue(const LoggedSignal & sym) {
+  switch (sym.Type) {
+    case (asi_bool): return *((bool*)sym.addr);
+    case (asi_byte): return *((byte*)sym.addr);
+    case (asi_short): return *((short*)sym.addr);
+    case (asi_ushort): return *((unsigned short*)sym.addr);
+    case (asi_int): return *((int*)sym.addr);
+    case (asi_uint): return *((unsigned int*)sym.addr);
+    case (asi_long): return *((long*)sym.addr);
+    case (asi_ulong): return *((unsigned long*)sym.addr);
+    case (asi_float): return *((float*)sym.addr);
+    case (asi_double): return *((double*)sym.addr);
+    case (asi_scaled8):
+    case (asi_scaled16): {
+        //The value of the variable itself, not the raw value sent
+        const ASIScaledValue * scaled = (const ASIScaledValue *)sym.addr;
+        LoggedSignal source = { 0, scaled->addr, scaled->SourceType, 0 };
+        return signalValue(source);
+      }
+    case (asi_block): {
+        //First element of the first field
+        const ASIBlockValue * block = (const ASIBlockValue *)sym.addr;
+        LoggedSignal element = { 0, (byte *)block->addr + block->field(0).Offset, block->field(0).Type, 0 };
+        return signalValue(element);
+      }
+  }
+  return 0;
+}
+
+bool AdvancedSerial::setTrigger(unsigned int SymbolID, float threshold, byte edge, unsigned int preSamples, unsigned long msg_id) {
+  if (SymbolID >= signalCount || edge == 0) return false;
+  noInterrupts();
+  TriggerPredicate = 0;
+  TriggerSignal = SymbolID;
+  TriggerThreshold = threshold;
+  TriggerEdge = edge;
+  interrupts();
+  armTrigger(preSamples, msg_id);
+  return SampleCapacity > 0;
+}
+
+bool AdvancedSerial::setTrigger(ASITriggerPredicate predicate, unsigned int preSamples, unsigned long msg_id) {
+  if (predicate == 0) return false;
+  noInterrupts();
+  TriggerPredicate = predicate;
+  interrupts();
+  armTrigger(preSamples, msg_id);
+  return SampleCapacity > 0;
+}
+
+void AdvancedSerial::armTrigger(unsigned int preSamples, unsigned long msg_id) {
+  TriggerMessageID = msg_id;
+  noInterrupts();
+  TriggerPre = preSamples;
+  if (SampleCapacity > 0 && TriggerPre >= SampleCapacity) TriggerPre = SampleCapacity - 1;
+  TriggerState = asi_trigger_armed;
+  TriggerHasLast = false;
+  interrupts();
+}
+
+void AdvancedSerial::clearTrigger() {
+  //Back to the plain burst buffer, the recorded snapshots are kept
+  noInterrupts();
+  TriggerState = asi_trigger_off;
+  interrupts();
+}
+
+bool AdvancedSerial::isCaptureComplete() {
+  return TriggerState == asi_trigger_captured;
+}
+
+void AdvancedSerial::setSamplePeriod(unsigned long period_us) {
+  //period_us > 0: Read()/update() call sample() every period_us
+  SamplePeriod_us = period_us;
+  SampleNextDue_us = micros();
+}
+
+void AdvancedSerial::cmdTrigger(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  //<LOGGING_TRIGGER,MSGID_0,..,3,ID,THRESHOLD,EDGE,PRE,DIVISOR,PERIOD_US>
+  if (parameterCount < 7) {
+    asi->clearTrigger();
+    return;
+  }
+  float threshold = parameter[5];
+  if (parameter[8] != 0) threshold /= parameter[8];
+  if (parameter[9] > 0) asi->setSamplePeriod(parameter[9]);
+  asi->setTrigger(parameter[4] < 0 ? 0 : parameter[4], threshold, parameter[6], parameter[7] < 0 ? 0 : parameter[7], messageID(parameter));
+}
+
+unsigned int AdvancedSerial::getSampleCount() {
+  noInterrupts();
+  unsigned int count = SampleCount;
+  interrupts();
+  return count;
+}
+
+unsigned long AdvancedSerial::getDroppedSamples() {
+  noInterrupts();
+  unsigned long dropped = SamplesDropped;
+  interrupts();
+  return dropped;
+}
+
+void AdvancedSerial::TransmitBurst(unsigned long msg_id, bool send_eol, unsigned int maxSamples) {
+  //During a capture the buffer belongs to the trigger, it is sent as B7 when complete
+  if (TriggerState == asi_trigger_armed || TriggerState == asi_trigger_post) return;
+  transmitSamples(0xB3, msg_id, send_eol, maxSamples);
+}
+
+void AdvancedSerial::transmitSamples(byte msg_key, unsigned long msg_id, bool send_eol, unsigned int maxSamples) {
+
+  unsigned int count = getSampleCount();
+  if (maxSamples > 0 && count > maxSamples) count = maxSamples;
+  if (!reserveFrameBuffer()) return;
+
+  if (TxBuffer != 0 && TxFrameDepth == 0) {
+    //Async: A frame longer than the whole ring can never be queued
+    unsigned int fixed = (CobsBuffer ? ASI_FRAMED_HEADER_LENGTH : ASI_HEADER_LENGTH) + (msg_key == 0xB7 ? 2 : 0)
+                         + 4 + signalCount * ASI_ID_LENGTH + (send_eol && !CobsBuffer ? ASI_TRAILER_LENGTH : 0);
+    if (msg_key == 0xB7) {
+      unsigned int length = txFrameLength(fixed + count * SampleLength);
+      if (length > TxBufferSize - 1) {
+        //The window is only sent whole: drop it once and release the buffer, LOGGING_TRIGGER arms again
+        TxFramesDropped++;
+        noInterrupts();
+        SampleTail = SampleHead;
+        SampleCount = 0;
+        TriggerState = asi_trigger_off;
+        interrupts();
+        return;
       }
+      txDrain();
+      if (length > txFree()) return; //ring still busy, update() tries again
+    } else {
+      //B3: as many of the oldest snapshots as fit, the rest stays for the next request
+      while (count > 0 && txFrameLength(fixed + count * SampleLength) > TxBufferSize - 1) count--;
     }
   }
-  if (send_eol) {
-    SerialRef->write("ENDOFASI");
-    SerialRef->write("\r\n");
+
+  //Header, <N><K> and the K signal IDs fit into the FrameBuffer (sized for a B1 frame)
+  byte * p = packHeader(FrameBuffer, msg_key, msg_id);
+  if (msg_key == 0xB7) {
+    *p++ = lowByte(TriggerIndex);
+    *p++ = highByte(TriggerIndex);
+  }
+  *p++ = lowByte(count);
+  *p++ = highByte(count);
+  *p++ = lowByte(signalCount);
+  *p++ = highByte(signalCount);
+  for (unsigned int i = 0; i < signalCount; i++) {
+    *p++ = lowByte(i);
+    *p++ = highByte(i);
   }
 
-  SerialRef->flush();
+  txBeginFrame();
+  txWrite(FrameBuffer, p - FrameBuffer);
+
+  //Snapshots are stored as <Timestamp><DATA_1>..<DATA_K>, written in at most two pieces
+  unsigned int first = SampleTail;
+  unsigned int remaining = count;
+  while (remaining > 0) {
+    unsigned int chunk = SampleCapacity - first;
+    if (chunk > remaining) chunk = remaining;
+    txWrite(SampleBuffer + first * SampleLength, chunk * SampleLength);
+    remaining -= chunk;
+    first = 0;
+  }
+
+  if (send_eol) txTrailer();
+
+  //Samples are only released once the frame was sent or queued
+  if (txEndFrame()) {
+    if (count > 0) SampleTail = (SampleTail + count) % SampleCapacity;
+    noInterrupts();
+    SampleCount -= count;
+    if (msg_key == 0xB7) TriggerState = asi_trigger_off; //single shot, LOGGING_TRIGGER arms again
+    interrupts();
+  }
 }
 
-void AdvancedSerial::WireTransmitData(unsigned long msg_id, bool send_eol) {
+void AdvancedSerial::cmdGetBurst(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  asi->TransmitBurst(messageID(parameter), true, parameter[4] < 0 ? 0 : parameter[4]);
+}
 
-  this->TransmitData(msg_id, false);
 
-  int signalcount = 0;
+bool AdvancedSerial::wireSelectMode(byte address, byte mode) {
+  //Tells the slave which response the next requests get (see WireSlaveReceive())
+  for (byte retries = 0; retries < 4; retries++) {
+    if (retries > 0) ASI_STAT_ADD(WireRetries, 1);
+    Wire.beginTransmission(address);
+    Wire.write(mode);
+    if (Wire.endTransmission() == 0) return true; //0: success
+  }
+  return false;
+}
 
-  for (int slaveindex = 0; slaveindex <= 127; slaveindex++) { //Cycle through slaves
-    if (SLAVE_FOUND[slaveindex]) {
-      byte transmissionIsSuccess = false;
+bool AdvancedSerial::probeSlave(byte address) {
+  //Asks one address for its slave info and adds, updates or removes its entry in the slave list
+  byte s = 0;
+  while (s < SlaveCount && Slaves[s].Address < address) s++;
+  bool known = s < SlaveCount && Slaves[s].Address == address;
+
+  //No retries here: Most addresses are empty
+  bool present = false;
+  Wire.beginTransmission(address);
+  Wire.write(2);
+  if (Wire.endTransmission() == 0) {
+    //Slave info: 0xAA, <SignalCount uint16>, <SymbolHash uint32>
+    present = Wire.requestFrom(address, (byte)7) >= 7 && Wire.read() == 0xAA;
+  }
 
-      for (byte retries = 0; retries < 4; retries++) {
-        Wire.beginTransmission(slaveindex);
-        Wire.write(1);
-        transmissionIsSuccess = Wire.endTransmission();
-        if (transmissionIsSuccess == 0) break; //0: success
+  if (!present) {
+    if (known) {
+      delete[] Slaves[s].Cache;
+      for (; s + 1 < SlaveCount; s++) Slaves[s] = Slaves[s + 1];
+      SlaveCount--;
+    }
+    return false;
+  }
+
+  unsigned int count = Wire.read();
+  count |= (unsigned int)Wire.read() << 8;
+  uint32_t hash = 0;
+  for (byte i = 0; i < 4; i++) hash |= (uint32_t)Wire.read() << (8 * i);
+
+  if (!known) {
+    if (SlaveCount >= ASI_MAX_SLAVES) return false;
+    //Keep the list sorted by address
+    for (byte pos = SlaveCount; pos > s; pos--) Slaves[pos] = Slaves[pos - 1];
+    SlaveCount++;
+    Slaves[s].Address = address;
+    Slaves[s].Cache = 0;
+    Slaves[s].CacheSize = 0;
+    Slaves[s].CacheLength = 0;
+  } else if (Slaves[s].SymbolHash != hash) {
+    Slaves[s].CacheLength = 0; //other signals now, the cached values don't match them
+  }
+  Slaves[s].SignalCount = count;
+  Slaves[s].SymbolHash = hash;
+  return true;
+}
+
+byte AdvancedSerial::discoverSlaves(byte firstAddress, byte lastAddress) {
+  //Probes firstAddress..lastAddress once and updates the matching part of the slave list,
+  //slaves outside the range are kept. Returns the number of known slaves.
+  if (firstAddress < 1) firstAddress = 1;
+  if (lastAddress > 127) lastAddress = 127;
+
+  PollState = asi_poll_idle; //the list changes under a running background poll
+  for (byte address = firstAddress; address <= lastAddress && address != 0; address++) {
+    probeSlave(address);
+  }
+  SlavesDiscovered = true;
+  return SlaveCount;
+}
+
+byte AdvancedSerial::getSlaveCount() {
+  return SlaveCount;
+}
+
+void AdvancedSerial::syncSlaves() {
+  //Asks every known slave to publish a new snapshot of its signals
+  PollState = asi_poll_idle;
+  for (byte s = 0; s < SlaveCount; s++) wireSelectMode(Slaves[s].Address, 4);
+}
+
+bool AdvancedSerial::publishSnapshot() {
+  //Packs all values of a slave into the free half of WireSnapshot, then makes it the one the
+  //Wire handlers answer from. Call it after updating the signals, the handlers then only copy bytes.
+  unsigned int length = valueLength();
+  if (WireSnapshot == 0 || length != WireSnapshotLength) {
+    noInterrupts();
+    WireSnapshotSignals = 0;
+    WireSnapshotReading = 0xFF;
+    WireSnapshotFront = 0;
+    WireLatched = false;
+    bool reserved = reserveBuffer(WireSnapshot, WireSnapshotSize, 2 * length);
+    WireSnapshotLength = reserved ? length : 0;
+    interrupts();
+    if (!reserved) return false;
+  }
+
+  noInterrupts();
+  bool published = !WireLatched && packSnapshot(); //a latched snapshot waits for the master
+  interrupts();
+  return published;
+}
+
+void AdvancedSerial::republishSnapshot() {
+  //The signal list changed: A snapshot with the old signals would not match the count the master
+  //reads in info mode, so it is dropped. Slaves that publish get a new one at once (also for a latch)
+  if (WireSnapshot == 0) return;
+  noInterrupts();
+  WireSnapshotSignals = 0;
+  WireSnapshotReading = 0xFF;
+  WireLatched = false;
+  interrupts();
+  publishSnapshot();
+}
+
+bool AdvancedSerial::packSnapshot() {
+  //Called with interrupts off (publishSnapshot()) or from the Wire handler (latch), never allocates
+  if (WireSnapshot == 0 || valueLength() != WireSnapshotLength) return false;
+
+  byte back = WireSnapshotFront ^ 1;
+  if (back == WireSnapshotReading) return false; //master still reads it, try again later
+
+  byte * p = WireSnapshot + back * WireSnapshotLength;
+  for (unsigned int i = 0; i < signalCount; i++) {
+    p += packValue(p, Signals[i]);
+  }
+  WireSnapshotFront = back;
+  WireSnapshotSignals = signalCount;
+  return true;
+}
+
+void AdvancedSerial::latchSlaves() {
+  //General call (address 0): every slave takes its snapshot in the same moment, the data is
+  //collected afterwards by the next data request or background poll
+  Wire.beginTransmission(0);
+  Wire.write(5);
+  Wire.endTransmission();
+
+  if (PollInterval_ms > 0) {
+    //Start a new round at once, so the caches hold the latched values soon
+    PollState = asi_poll_idle;
+    PollCycleStart_ms = millis() - PollInterval_ms;
+  }
+}
+
+void AdvancedSerial::cmdLatch(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  asi->latchSlaves();
+}
+
+void AdvancedSerial::cmdDiscover(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  //<LOGGING_DISCOVER> scans the whole bus, <LOGGING_DISCOVER,FIRST,LAST> only a range,
+  //clamped to the non-reserved addresses before it is narrowed to byte
+  if (parameterCount >= 2) {
+    long first = parameter[0] < ASI_WIRE_FIRST_ADDRESS ? ASI_WIRE_FIRST_ADDRESS : parameter[0];
+    long last = parameter[1] > ASI_WIRE_LAST_ADDRESS ? ASI_WIRE_LAST_ADDRESS : parameter[1];
+    if (first <= last) asi->discoverSlaves(first, last);
+  } else {
+    asi->discoverSlaves(1, 127);
+  }
+}
+
+void AdvancedSerial::WireTransmitSymbols(unsigned long msg_id, bool send_eol) {
+
+  PollState = asi_poll_idle; //the slaves are switched to the symbol list
+  txBeginFrame();
+  this->TransmitSymbols(msg_id, false);
+
+  if (!SlavesDiscovered) discoverSlaves(1, 127);
+
+  unsigned int firstID = signalCount; //IDs of a slave follow the ones of the slaves before
+
+  for (byte s = 0; s < SlaveCount; s++) { //Cycle through the known slaves
+    byte slaveindex = Slaves[s].Address;
+    unsigned int signalcount = 0;
+    if (Slaves[s].SignalCount == 0 || !wireSelectMode(slaveindex, 0)) {
+      firstID += Slaves[s].SignalCount;
+      continue;
+    }
+
+    bool eolist_found = false;
+    bool slave_found = false;
+
+    //One symbol per request, a few spare requests for empty responses
+    for (unsigned int i = 0; i < Slaves[s].SignalCount + 4; i++) {
+      byte receivedBytes = Wire.requestFrom(slaveindex, (byte)32);    // request 32 bytes from slave device
+      if (receivedBytes < 2) {
+        ASI_STAT_ADD(WireEmpty, 1);
+        continue; //try again
       }
 
-      if (transmissionIsSuccess == 0) {
-        bool eolist_found = false;
-        for (int slaveASIsignal = 0; slaveASIsignal < 1000; slaveASIsignal++) {
-          byte receivedBytes = Wire.requestFrom(slaveindex, 32);    // request 32 bytes from slave device
-          if (receivedBytes < 2) continue; //try again
-
-          bool eosignal_found = false;
-
-          //Signal Key
-          Serial.write(lowByte(signalCount + signalcount));
-          Serial.write(highByte(signalCount + signalcount));
-
-          signalcount += 1;
-          for (int symbolchar = 0; symbolchar <= 31; symbolchar++) { // slave may send less than requested
-            char bytecount = Wire.read(); //first receive number of bytes to expect
-            char c;
-            for (int i = 0; i < bytecount; i++) {
-              c = Wire.read(); //then read the data bytes
-              Serial.print(c);
-            }
-            char c_before = char(0x7F);
-            byte endoflist_count = 0;
-            //for (int i = 0; i < 32; i++) {//empty buffer
-            while (Wire.available()) { //empty buffer
-              c = Wire.read();
-              if (c == char(0x7F) && c_before == char(0x7F)) endoflist_count += 1;
-              c_before = c;
-            }
-            if (endoflist_count == 8) eolist_found = true; //8 times 0x7F -> All Wire data received from slave
-          }
-          if (eolist_found) break;
-        }
+      if (!slave_found) {
+        //Expecting response 0xAA from slave before the first symbol
+        if (Wire.read() != 0xAA) break;
+        slave_found = true;
       }
 
+      //Signal Key
+      txWrite(lowByte(firstID + signalcount));
+      txWrite(highByte(firstID + signalcount));
+
+      //Signal Name + \0 + Signal Type + metadata of the type, then "\r" and "\n" after the last symbol
+      char c;
+      do {
+        c = Wire.read();
+        txWrite(c);
+      } while (c != '\0' && Wire.available());
+      byte typeCode = Wire.read();
+      txWrite(typeCode);
+      for (byte m = metadataLength(typeCode); m > 0; m--) txWrite((byte)Wire.read());
+      signalcount += 1;
+      if (Wire.read() == 0x0D && Wire.read() == 0x0A) eolist_found = true;
+      while (Wire.available()) Wire.read(); //empty buffer
+      if (eolist_found) break;
+    }
+    firstID += Slaves[s].SignalCount;
+  }
+  if (send_eol) {
+    txTrailer();
+  }
+
+  txEndFrame();
+}
+
+int AdvancedSerial::wireReadChunk(byte address, unsigned int firstID, unsigned int & received, unsigned int expected, byte * dst, bool & last) {
+  //Requests one packed chunk (see WireSlaveTransmitPacked()) and writes its values as
+  //<SymbolID><DATA> to dst (up to ASI_WIRE_CHUNK_DATA bytes). Returns the bytes written, -1 for no valid chunk.
+  byte receivedBytes = Wire.requestFrom(address, (byte)ASI_WIRE_CHUNK_LENGTH);
+  if (receivedBytes < 2) {
+    ASI_STAT_ADD(WireEmpty, 1);
+    return -1;
+  }
+
+  //The header comes from the bus: check it against what was received before anything is written
+  byte chunk[ASI_WIRE_CHUNK_LENGTH];
+  if (receivedBytes > sizeof(chunk)) receivedBytes = sizeof(chunk);
+  for (byte i = 0; i < receivedBytes; i++) chunk[i] = Wire.read();
+  while (Wire.available()) Wire.read(); //empty buffer
+
+  byte count = chunk[0] & 0x7F;
+  byte length = chunk[1];
+  byte codeBytes = (count + 3) / 4;
+  const byte * codes = chunk + 2;
+  bool valid = count > 0 && count <= expected - received && 2 + codeBytes + length <= receivedBytes;
+  unsigned int sizes = 0;
+  for (byte i = 0; valid && i < count; i++) sizes += 1 << ((codes[i / 4] >> (2 * (i % 4))) & 0x03);
+  if (!valid || sizes != length || count * ASI_ID_LENGTH + length > ASI_WIRE_CHUNK_DATA) {
+    ASI_STAT_ADD(WireEmpty, 1);
+    return -1;
+  }
+  last = chunk[0] & 0x80;
+
+  const byte * value = codes + codeBytes;
+  byte * p = dst;
+  for (byte i = 0; i < count; i++) {
+    //Signal Key
+    *p++ = lowByte(firstID + received);
+    *p++ = highByte(firstID + received);
+    byte size = 1 << ((codes[i / 4] >> (2 * (i % 4))) & 0x03);
+    memcpy(p, value, size);
+    p += size;
+    value += size;
+    received++;
+  }
+  if (received >= expected) last = true;
+  return p - dst;
+}
+
+void AdvancedSerial::WireTransmitData(unsigned long msg_id, bool send_eol) {
+
+  if (PollInterval_ms > 0) {
+    //Background polling: answer from the slave caches without touching the bus
+    txBeginFrame();
+    this->TransmitData(msg_id, false);
+    for (byte s = 0; s < SlaveCount; s++) {
+      if (Slaves[s].CacheLength > 0) txWrite(Slaves[s].Cache, Slaves[s].CacheLength);
     }
+    if (send_eol) txTrailer();
+    txEndFrame();
+    TransmitSlaveAges(msg_id);
+    return;
+  }
+
+  PollState = asi_poll_idle;
+  ASI_TIMER_START(start_us);
+  txBeginFrame();
+  this->TransmitData(msg_id, false);
+
+  unsigned int firstID = signalCount; //IDs of a slave follow the ones of the slaves before
+
+  for (byte s = 0; s < SlaveCount; s++) { //Cycle through the known slaves
+    byte slaveindex = Slaves[s].Address;
+    unsigned int slaveSignals = Slaves[s].SignalCount;
+    if (slaveSignals == 0 || !wireSelectMode(slaveindex, 3)) {
+      firstID += slaveSignals;
+      continue;
+    }
+
+    //Packed chunks, a few spare requests for empty responses
+    unsigned int received = 0;
+    for (unsigned int request = 0; request < slaveSignals + 4; request++) {
+      byte chunk[ASI_WIRE_CHUNK_DATA];
+      bool last = false;
+      int length = wireReadChunk(slaveindex, firstID, received, slaveSignals, chunk, last);
+      if (length < 0) continue; //try again
+      txWrite(chunk, length);
+      if (last) break;
+    }
+    firstID += slaveSignals;
   }
 
   if (send_eol)
   {
-    SerialRef->write("ENDOFASI");
-    SerialRef->write("\r\n");
+    txTrailer();
+  }
+
+  txEndFrame();
+  ASI_TIMER_STOP(Wire_us, start_us);
+}
+
+void AdvancedSerial::TransmitSlaveAges(unsigned long msg_id) {
+  //B4: <ADDRESS><AGE_MS> of every known slave, AGE_MS = 0xFFFFFFFF before its first complete poll
+  byte frame[ASI_HEADER_LENGTH + 5 * ASI_MAX_SLAVES + ASI_TRAILER_LENGTH];
+  byte * p = packHeader(frame, 0xB4, msg_id);
+  unsigned long now = millis();
+  for (byte s = 0; s < SlaveCount; s++) {
+    unsigned long age = Slaves[s].CacheLength > 0 ? now - Slaves[s].CacheTime_ms : 0xFFFFFFFFUL;
+    *p++ = Slaves[s].Address;
+    memcpy(p, &age, 4);
+    p += 4;
   }
+  p = packTrailer(p);
+  txBeginFrame();
+  txWrite(frame, p - frame);
+  txEndFrame();
+}
+
+void AdvancedSerial::setBackgroundPolling(unsigned long interval_ms) {
+  //interval_ms > 0: update() polls the slaves in the background, one I2C transaction per call,
+  //a new round starts every interval_ms. 0: WireTransmitData() polls synchronously (default)
+  PollInterval_ms = interval_ms;
+  PollState = asi_poll_idle;
+  PollCycleStart_ms = millis() - interval_ms;
+}
 
-  SerialRef->flush();
+void AdvancedSerial::pollNextSlave() {
+  //Skips slaves without signals, back to idle after the last one
+  while (PollSlave < SlaveCount && Slaves[PollSlave].SignalCount == 0) PollSlave++;
+  PollState = PollSlave < SlaveCount ? asi_poll_select : asi_poll_idle;
+  PollRetries = 0;
+}
+
+void AdvancedSerial::pollStep() {
+  //One step of the background poll, at most one I2C transaction (two for a present slave while discovering)
+  switch (PollState) {
+    case (asi_poll_idle): {
+        if (millis() - PollCycleStart_ms < PollInterval_ms) return;
+        PollCycleStart_ms = millis();
+        PollSlave = 0;
+        PollAddress = 1;
+        if (SlavesDiscovered) pollNextSlave();
+        else PollState = asi_poll_discover;
+      } break;
+    case (asi_poll_discover): {
+        probeSlave(PollAddress);
+        if (PollAddress++ >= 127) {
+          SlavesDiscovered = true;
+          pollNextSlave();
+        }
+      } break;
+    case (asi_poll_select): {
+        //Room for all values as doubles, reserveBuffer() does not keep the content when it grows
+        if (!reserveBuffer(PollBuffer, PollBufferSize, Slaves[PollSlave].SignalCount * (ASI_ID_LENGTH + 8))) {
+          PollState = asi_poll_idle;
+          return;
+        }
+        Wire.beginTransmission(Slaves[PollSlave].Address);
+        Wire.write(3);
+        if (PollRetries > 0) ASI_STAT_ADD(WireRetries, 1);
+        if (Wire.endTransmission() == 0) {
+          PollState = asi_poll_read;
+          PollRequests = 0;
+          PollReceived = 0;
+          PollLength = 0;
+        } else if (++PollRetries >= 4) {
+          PollSlave++;
+          pollNextSlave();
+        }
+      } break;
+    case (asi_poll_read): {
+        ASISlave & slave = Slaves[PollSlave];
+        unsigned int firstID = signalCount;
+        for (byte s = 0; s < PollSlave; s++) firstID += Slaves[s].SignalCount;
+
+        bool last = false;
+        int length = wireReadChunk(slave.Address, firstID, PollReceived, slave.SignalCount, PollBuffer + PollLength, last);
+        if (length > 0) PollLength += length;
+
+        if (last) {
+          //Complete: the poll buffer becomes the cache, the old cache the next poll buffer
+          byte * cache = slave.Cache;
+          unsigned int cacheSize = slave.CacheSize;
+          slave.Cache = PollBuffer;
+          slave.CacheSize = PollBufferSize;
+          slave.CacheLength = PollLength;
+          slave.CacheTime_ms = millis();
+          PollBuffer = cache;
+          PollBufferSize = cacheSize;
+        }
+        if (last || ++PollRequests >= slave.SignalCount + 4) {
+          PollSlave++;
+          pollNextSlave();
+        }
+      } break;
+  }
 }
 
 void AdvancedSerial::TransmitDataInterval(unsigned long msg_id, bool send_eol) {
 
+  txDrain();
+
+  if (RateGroupCount > 0) {
+    if (LoggingActivated) this->TransmitScheduledData(msg_id, true);
+    return;
+  }
+
   if (LoggingFirstTime == true) LoggingFirstTimeDone_ms = millis();
   unsigned long loggingElapsedTime_ms = (millis() - LoggingFirstTimeDone_ms);
 
   if (((loggingElapsedTime_ms >= LoggingTimeSet_ms) || LoggingFirstTime == true) && LoggingActivated == true) {
-    if (LoggingFirstTime == false) LoggingTimeSet_ms += LoggingInterval_ms;
+    if (LoggingFirstTime == false) {
+      ASI_TIMING(IntervalLate_ms, loggingElapsedTime_ms - LoggingTimeSet_ms);
+      LoggingTimeSet_ms += LoggingInterval_ms;
+    }
     LoggingFirstTime = false;
 
-    if (LOGGING_MODE == 0 || LOGGING_MODE == 2)
+    if ((LOGGING_MODE == 0 || LOGGING_MODE == 2) && AggregateFrames)
+    {
+      this->TransmitAggregates(msg_id, true);
+    }
+    else if ((LOGGING_MODE == 0 || LOGGING_MODE == 2) && DeltaKeyframeInterval > 0)
+    {
+      this->transmitDelta(msg_id, true, CompressedFrames);
+    }
+    else if (LOGGING_MODE == 0 || LOGGING_MODE == 2)
     {
       this->TransmitData(msg_id, true);
     }
@@ -553,52 +2266,18 @@ void AdvancedSerial::WireSlaveTransmitSingleSymbol() {
 
   if (wireSignalCount == 0) Wire.write(0xAA);
 
-  LoggedSignal sym = Signals[wireSignalCount];
+  const LoggedSignal & sym = Signals[wireSignalCount];
 
-  char little_s_string[32] = "";
-  sym.Name.toCharArray(little_s_string, 32);
+  //0xAA + Name + \0 + Type + metadata + \r\n have to fit into one response
+  byte metadata[ASI_MAX_METADATA_LENGTH];
+  byte metadataBytes = packMetadata(metadata, sym);
+  char little_s_string[ASI_WIRE_CHUNK_LENGTH] = "";
+  copyName(little_s_string, ASI_WIRE_CHUNK_LENGTH - 4 - metadataBytes, sym);
   Wire.write(little_s_string);
 
   Wire.write('\0');
-
-  switch (sym.Type) {
-    case (asi_bool): {
-        Wire.write(0x0);
-        break;
-      }
-    case (asi_byte): {
-        Wire.write(0x1);
-        break;
-      }
-    case (asi_short): {
-        Wire.write(0x2);
-        break;
-      }
-    case (asi_int): {
-        Wire.write(0x3);
-        break;
-      }
-    case (asi_uint): {
-        Wire.write(0x4);
-        break;
-      }
-    case (asi_long): {
-        Wire.write(0x5);
-        break;
-      }
-    case (asi_ulong): {
-        Wire.write(0x6);
-        break;
-      }
-    case (asi_float): {
-        Wire.write(0x7);
-        break;
-      }
-    case (asi_double): {
-        Wire.write(0x8);
-        break;
-      }
-  }
+  Wire.write(ASI_TYPE_CODE[sym.Type]);
+  Wire.write(metadata, metadataBytes);
 
   Wire.write(0x0D);
 
@@ -611,9 +2290,15 @@ void AdvancedSerial::WireSlaveTransmitSingleSymbol() {
 
 void AdvancedSerial::WireSlaveTransmitSingleDataPoint() {
 
-  LoggedSignal sym = Signals[wireSignalCount];
+  const LoggedSignal & sym = Signals[wireSignalCount];
 
-  switch (sym.Type) {
+  if (WireSnapshotReading != 0xFF && wireSignalCount < WireSnapshotSignals) {
+    //Pre-packed by publishSnapshot()
+    byte size = ASI_TYPE_SIZE[sym.Type];
+    Wire.write(size);
+    Wire.write(WireSnapshot + WireSnapshotReading * WireSnapshotLength + WireReadOffset, size);
+    WireReadOffset += size;
+  } else switch (sym.Type) {
     case (asi_bool): {
         boolCvt.val = *((bool*)sym.addr);
         Wire.write(1);  //first byte count
@@ -659,12 +2344,21 @@ void AdvancedSerial::WireSlaveTransmitSingleDataPoint() {
         Wire.write(8);
         Wire.write(dblCvt.bval, 8);
       } break;
+    default: {
+        byte value[8];
+        byte size = packValue(value, sym);
+        Wire.write(size);
+        Wire.write(value, size);
+      } break;
   }
 
 
   wireSignalCount += 1;
   if (wireSignalCount >= signalCount) {
     wireSignalCount = 0;
+    WireReadOffset = 0;
+    if (WireSnapshotReading == WireSnapshotFront) WireLatched = false;
+    WireSnapshotReading = 0xFF;
     Wire.write(0x7F);
     Wire.write(0x7F);
     Wire.write(0x7F);
@@ -676,17 +2370,95 @@ void AdvancedSerial::WireSlaveTransmitSingleDataPoint() {
   }
 }
 
+void AdvancedSerial::WireSlaveTransmitPacked() {
+  //Fills one response with as many whole values as fit, starting at wireSignalCount:
+  //<count | 0x80 on the last chunk>, <length of the values>,
+  //<size codes: 2 bits per value, 0..3 -> 1, 2, 4, 8 bytes>, <values>
+  byte chunk[ASI_WIRE_CHUNK_LENGTH];
+  byte codes[(ASI_WIRE_CHUNK_LENGTH + 3) / 4];
+  byte count = 0;
+  byte length = 0;
+  bool snapshot = WireSnapshotReading != 0xFF;
+  unsigned int signals = snapshot ? WireSnapshotSignals : signalCount;
+
+  memset(codes, 0, sizeof(codes));
+  while (wireSignalCount + count < signals) {
+    byte size = ASI_TYPE_SIZE[Signals[wireSignalCount + count].Type];
+    if (2 + (count + 4) / 4 + length + size > ASI_WIRE_CHUNK_LENGTH) break;
+    byte code = size == 1 ? 0 : size == 2 ? 1 : size == 4 ? 2 : 3;
+    codes[count / 4] |= code << (2 * (count % 4));
+    length += size;
+    count++;
+  }
+
+  byte codeBytes = (count + 3) / 4;
+  byte * values = chunk + 2 + codeBytes;
+  if (snapshot) {
+    //Pre-packed by publishSnapshot()
+    memcpy(values, WireSnapshot + WireSnapshotReading * WireSnapshotLength + WireReadOffset, length);
+    WireReadOffset += length;
+  } else {
+    byte * p = values;
+    for (byte i = 0; i < count; i++) p += packValue(p, Signals[wireSignalCount + i]);
+  }
+  wireSignalCount += count;
+
+  chunk[0] = count;
+  if (wireSignalCount >= signals) {
+    chunk[0] |= 0x80;
+    wireSignalCount = 0;
+    WireReadOffset = 0;
+    if (WireSnapshotReading == WireSnapshotFront) WireLatched = false; //the master has the latched values
+    WireSnapshotReading = 0xFF; //read complete, the next publish may reuse the half
+  }
+  chunk[1] = length;
+  memcpy(chunk + 2, codes, codeBytes);
+  Wire.write(chunk, 2 + codeBytes + length);
+}
+
+void AdvancedSerial::WireSlaveTransmitInfo() {
+  //Answer to the discovery of the master: 0xAA, <SignalCount uint16>, <SymbolHash uint32>
+  byte info[7];
+  info[0] = 0xAA;
+  info[1] = lowByte(signalCount);
+  info[2] = highByte(signalCount);
+  for (byte i = 0; i < 4; i++) info[3 + i] = (SymbolHash >> (8 * i)) & 0xFF;
+  Wire.write(info, 7);
+}
+
 void AdvancedSerial::WireSlaveReceive() {
 
-  WireMode = Wire.read();
+  byte mode = Wire.read();
   //WireMode = 0 -> WireSlaveTransmitSingleSymbol()
   //WireMode = 1 -> WireSlaveTransmitSingleDataPoint()
+  //WireMode = 2 -> WireSlaveTransmitInfo()
+  //WireMode = 3 -> WireSlaveTransmitPacked()
+  //WireMode = 4 -> Sync: publish a new snapshot in the next update()
+  //WireMode = 5 -> Latch (general call): take the snapshot right here
+
+  if (mode == 5 && packSnapshot()) {
+    WireLatched = true;
+    return;
+  }
+  if (mode == 4) WireLatched = false; //the master asks for new values
+  if (mode == 4 || mode == 5) {
+    WireSyncRequested = true; //for a latch only if no snapshot buffer was published yet or it is being read
+    return; //keeps the current WireMode
+  }
+  WireMode = mode;
 
   wireSignalCount = 0;
+  WireReadOffset = 0;
+  //A data read uses the newest snapshot until its last value
+  WireSnapshotReading = (WireMode == 1 || WireMode == 3) && WireSnapshotSignals > 0 ? WireSnapshotFront : 0xFF;
 }
 
 void AdvancedSerial::WireSlaveTransmitToMaster() {
+  ASI_TIMER_START(start_us);
 
   if (WireMode == 0) this->WireSlaveTransmitSingleSymbol();
   if (WireMode == 1) this->WireSlaveTransmitSingleDataPoint();
+  if (WireMode == 2) this->WireSlaveTransmitInfo();
+  if (WireMode == 3) this->WireSlaveTransmitPacked();
+  ASI_TIMER_STOP(Wire_us, start_us);
 }
\ No newline at end of file
@@ -18,8 +18,41 @@
 //   StringCommand:   <COMMAND, STRING_01  ,PARAMETER_02,...,PARAMETER_10>
 //                    <---------max. 64 chars---------------------------->
 //   COMMAND:             String, Upper case w/o spaces, e.g. MIPIWRITE
-//   PARAMETER:           Int 16 Bit, max 10 parameters
+//   PARAMETER:           Int 32 Bit (long, may be negative), max 10 parameters, clamped to LONG_MIN..LONG_MAX
 //   STRING_01:           max. 15 chars
+//   Built-in commands: LOGGING_GETSIGNALLIST, LOGGING_GETDATA, LOGGING_GETDELTA, LOGGING_SETDELTA,
+//                      LOGGING_ACTIVATE, LOGGING_DEACTIVATE
+//                      LOGGING_ACTIVATE_MS, LOGGING_SUBSCRIBE, LOGGING_SUBSCRIBERANGE, LOGGING_UNSUBSCRIBE,
+//                      LOGGING_GETBURST, LOGGING_TIMESTAMPS, LOGGING_SETCOMPRESSED, LOGGING_GETCOMPRESSED,
+//                      LOGGING_FRAMING, LOGGING_DISCOVER, LOGGING_LATCH, LOGGING_STATS, LOGGING_TRIGGER,
+//                      LOGGING_SETAGGREGATE, LOGGING_GETAGGREGATE, LOGGING_GETHASH
+//   Own commands are added with registerCommand(name, handler), a handler with the name of a
+//   built-in command replaces it. Received commands are echoed as <...> unless setCommandEcho(false).
+//
+//  -I2C MASTER-------------------------------------------------------------
+//   The master only talks to the slaves in its slave list. The list is filled by a bus scan on the
+//   first LOGGING_GETSIGNALLIST, <LOGGING_DISCOVER> rescans the bus, <LOGGING_DISCOVER,FIRST,LAST>
+//   only the addresses FIRST..LAST, limited to 0x08..0x77 (FIRST > LAST: no scan). Each slave reports
+//   its signal count and symbol hash.
+//   Data is read in packed chunks of up to 32 bytes: <COUNT>, <LENGTH>, 2 bit size code per value,
+//   values. A slave's whole data set takes about ceil(bytes/30) I2C transactions.
+//   Slaves that call publishSnapshot() after updating their signals answer from a double
+//   buffered snapshot, the Wire handlers then only copy bytes and values can't be torn.
+//   syncSlaves() asks all slaves to publish one in their next Read()/update().
+//   <LOGGING_LATCH> (latchSlaves()) sends a general call (address 0): all slaves take their snapshot
+//   in the Wire handler in the same moment, the master collects them afterwards. Until the master
+//   has read a latched snapshot, publishSnapshot() returns false and keeps it. A slave needs a
+//   publishSnapshot() in setup() for this (the handler does not allocate), AVR slaves enable the
+//   general call in begin().
+//   After setBackgroundPolling(INTERVAL_MS) the master collects the slave data in Read()/update(),
+//   one I2C transaction per call, and answers data requests at once from its cache (B1 + B4 frame).
+//
+//  -STREAMS----------------------------------------------------------------
+//   begin() takes any Stream (HardwareSerial, USB CDC, SoftwareSerial, a network client, ...).
+//   All receive, transmit and frame state is kept per instance, so several instances can log on
+//   different streams side by side. Async transmit drains by availableForWrite(), a stream without it
+//   (it returns 0) needs setAsyncTransmit(SIZE, true): the queued bytes are then written at once.
+//   Only one instance can be the I2C slave of the device.
 //
 //  -OUTGOING COMMANDS-----------------------------------------------------
 //    |--Header------------|-DATA--------------------|-EOT---------|
@@ -28,45 +61,454 @@
 //    MSGKEY:   DATA#:    DATA:                           DESCRIPTION:
 //     B0       N         <SymbolID><SymbolName><DTYPE>   Up to N Items. Response to request for available symbols.
 //     B1       N         <SymbolID><DATA>                Up to N Items. Response to request for Data.
+//     B2       N         <SymbolID><DATA>                Up to N Items. Delta Data: Only the signals whose value changed since the last frame.
+//                                                        Every <KEYFRAME> frames a full B1 frame is sent instead, so the host can resync.
+//     B5       1         <ENCODED_1>..<ENCODED_N>        Compressed Data: All N signals in SymbolID order without IDs, each
+//                                                        encoded against the value last sent for it. Keyframes as for B2.
+//     B3       1         <N><K><SymbolID_1>..<SymbolID_K>
+//                        N x <Timestamp><DATA_1>..<DATA_K>  Burst: N buffered snapshots of the K signals, oldest first.
+//     B6       1         <STATS>                         Response to <LOGGING_STATS,MSGID_0,..,3,RESET>, RESET = 1 clears them after sending.
+//     B7       1         <T><N><K><SymbolID_1>..<SymbolID_K>
+//                        N x <Timestamp><DATA_1>..<DATA_K>  Trigger capture: Like B3, <T> (uint) is the index of the trigger snapshot.
+//     B8       N         <COUNT>, N x <SymbolID><MIN><MAX><MEAN>  Aggregates of COUNT accumulate() calls, float each.
+//                                                        COUNT = 0: no accumulate() since the last B8, MIN = MAX = MEAN = current value.
+//     B9       1         <SymbolHash><N>                 Response to <LOGGING_GETHASH,MSGID_0,..,3>: The host only needs a new
+//                                                        B0 list if <SymbolHash> differs from the one of its cached list.
+//     B4       N         <ADDRESS><AGE_MS>               Age of the cached data of each I2C slave, sent after every B1 frame
+//                                                        served from the background poll cache (master only).
+//
+//  -DELTA FRAMES-----------------------------------------------------------
+//   <LOGGING_SETDELTA,KEYFRAME>      KEYFRAME > 0: TransmitDataInterval() sends B2 frames with a B1 keyframe every KEYFRAME frames
+//                                    KEYFRAME = 0: Delta frames off (default)
+//   <LOGGING_GETDELTA,MSGID_0,..,3>  Request a single B2 frame (B1 if a keyframe is due). With KEYFRAME = 0
+//                                    only the first request and a resync after a dropped frame get a B1 frame
+//   Master (I2C) mode always answers with full B1 frames.
+//   B2/B5 values continue from the last value the host got for each signal, also from B1 frames of
+//   LOGGING_GETDATA or subscriptions.
+//
+//  -COMPRESSED FRAMES------------------------------------------------------
+//   <LOGGING_SETCOMPRESSED,KEYFRAME>     Like LOGGING_SETDELTA, but TransmitDataInterval() sends B5 frames
+//   <LOGGING_GETCOMPRESSED,MSGID_0,..,3> Request a single B5 frame (B1 if a keyframe is due)
+//   <ENCODED> integer types: Difference to the last value (wrapping in the width of the type),
+//                            zigzag encoded ((d << 1) ^ (d >> 31)) as varint, 7 bits per byte, LSB first
+//             float, double: XOR of the value bits with the last value bits, sent as
+//                            <(L << 4) | N> + N bytes, L: leading zero bytes, N: meaningful bytes (0: unchanged)
+//
+//  -AGGREGATES-------------------------------------------------------------
+//   accumulate() (called from the fast loop) keeps min, max and sum of every signal.
+//   <LOGGING_SETAGGREGATE,1>                TransmitDataInterval() sends B8 frames with the aggregates since the
+//                                           last one instead of B1 frames, <LOGGING_SETAGGREGATE,0> switches back
+//   <LOGGING_GETAGGREGATE,MSGID_0,..,3>     Request a single B8 frame
+//   Aggregates are kept as float, long values above 2^24 lose precision. Own signals only (no I2C slaves).
+//
+//  -BURST FRAMES-----------------------------------------------------------
+//   sample() stores a snapshot of all signals in the buffer given to setSampleBuffer(). It is
+//   cheap enough for a timer ISR, a full buffer drops new snapshots (getDroppedSamples()).
+//   <LOGGING_GETBURST,MSGID_0,..,3,MAX>   Send up to MAX (0: all) buffered snapshots as B3 frame
+//
+//  -TRIGGER CAPTURE--------------------------------------------------------
+//   <LOGGING_TRIGGER,MSGID_0,..,3,ID,THRESHOLD,EDGE,PRE,DIVISOR,PERIOD_US>
+//   Arms a capture: the sample buffer becomes a ring that always keeps the newest snapshots. When
+//   signal ID crosses THRESHOLD / DIVISOR (DIVISOR 0: 1) with EDGE (1: rising, 2: falling, 3: both),
+//   the snapshot is the trigger, the buffer is filled up behind it and kept with PRE snapshots before
+//   it. The next Read()/update() sends the window as one B7 frame with MSGID. PERIOD_US > 0 lets
+//   Read()/update() call sample() every PERIOD_US, otherwise the sketch calls it. <LOGGING_TRIGGER>
+//   without parameters disarms. setTrigger(predicate, ...) triggers on a function of the sketch instead.
+//   With async transmit the B7 frame waits until the ring has room for it. A window larger than the
+//   whole ring is dropped once (getDroppedFrames()) and the capture is released. A B3 frame holds at
+//   most as many snapshots as fit into the ring.
+//
+//  -SUBSCRIPTIONS----------------------------------------------------------
+//   <LOGGING_ACTIVATE_MS,INTERVAL_MS>              Like LOGGING_ACTIVATE, interval in ms
+//   <LOGGING_SUBSCRIBE,PERIOD_MS,ID_1,..,ID_9>      Send the signals ID_1..ID_9 every PERIOD_MS
+//   <LOGGING_SUBSCRIBERANGE,PERIOD_MS,FIRST,LAST>   Send the signals FIRST..LAST every PERIOD_MS
+//   <LOGGING_UNSUBSCRIBE,ID_1,..,ID_10>             Remove the subscriptions of ID_1..ID_10, all without parameter
+//   While subscriptions exist, TransmitDataInterval() sends one B1 frame per tick with the
+//   signals that are due instead of all signals every LoggingInterval_ms. Signals subscribed with
+//   the same period form a rate group, there are up to ASI_MAX_RATE_GROUPS different periods.
+//   Subscriptions only cover the signals registered on this device (no I2C slave signals).
 //
 //                    TYPE:            DESCRIPTION:
+//    Data frames (B1, B2, B5) are sent with an extended header after <LOGGING_TIMESTAMPS,1>:
+//    #ASI:<MSGKEY>:<MSGID>:<FrameCounter><Timestamp><SymbolHash><SymbolID><DATA>...ENDOFASI<CRNL>
+//    <LOGGING_TIMESTAMPS,0> (default) switches back to the plain header, both reset <FrameCounter> to 0.
+//
+//    Framed transmit after <LOGGING_FRAMING,1> (<LOGGING_FRAMING,0> switches back):
+//    COBS(<MSGKEY><MSGID><DATA...><LEN><CRC16>) 0x00
+//    The packet is COBS encoded, so 0x00 only appears as delimiter at its end: After a lost byte the host
+//    resyncs at the next 0x00. <LEN> (uint16) is the number of bytes before it, <CRC16> (CRC-16/CCITT-FALSE,
+//    high byte first) covers all bytes before it. <DATA> is the same as between the header and ENDOFASI above.
+//    <LEN> trails the payload: Frames are encoded while they are written (a long symbol list may be handed to
+//    the stream before it is complete), so the length is only known at the end. The host finds the end by
+//    the 0x00 and checks <LEN> and <CRC16> after decoding.
+//    Commands are not echoed in framed mode.
+//
 //    <MSGKEY>        byte             Message KEY, A unique key for the type of message being sent
 //    <MSGID>         uint32/ulong     Message ID,  A unique message ID is which is echo's back to transmitter to indicate a response to a message (0 to 4294967295)
 //    <DATA>          (varying)        Message Data, varying data types and length depending on message
 //    ENDOFASI <CRNL> char             'ENDOFASI' + Carriage Return + New Line Character signifying the end of a transmission.
 //    <SymbolID>      uint             Symbol ID number
 //    <SymbolName>    String0          Symbol Name - Null Terminated String
-//    <DTYPE>         byte             DataType  0=Boolean, 1=Byte, 2=short, 3=int, 4=unsigned int, 5=long, 6=unsigned long, 7=float, 8=double
+//    <N>, <K>        uint             Number of snapshots / signals in a B3 frame
+//    <Timestamp>     uint32/ulong     micros() when the values were sampled
+//    <STATS>         8 x uint32       BytesSent, FramesSent, FramesDropped, CommandsReceived, CommandsTruncated,
+//                    + 4 x 4 x uint32 SamplesDropped, WireRetries, WireEmpty, then <Count><Min><Max><Avg> of the timers
+//                                     Transmit_us, Command_us, Wire_us, IntervalLate_ms (see ASIStats).
+//                                     Only with ASI_STATS 1 (default), the library is smaller without.
+//    <ADDRESS>       byte             I2C address of a slave
+//    <AGE_MS>        uint32/ulong     ms since the cached data of a slave was received, 0xFFFFFFFF: none yet
+//    <SymbolHash>    uint32/ulong     FNV-1a hash of the symbol list (names, types and metadata in SymbolID order), in master
+//                                     mode combined with the hashes, signal counts and addresses of the known slaves
+//    <FrameCounter>  uint32/ulong     Incremented with every data frame, a gap means the host lost a frame
+//    <DTYPE>         byte             DataType  0=Boolean, 1=Byte, 2=short, 3=int, 4=unsigned int, 5=long, 6=unsigned long, 7=float, 8=double,
+//                                     9=scaled int8, 10=scaled int16: <DTYPE> is followed by <SCALE><OFFSET> (float each),
+//                                     the value is <DATA> * SCALE + OFFSET. Added with addSignal(name, &value, scale, offset).
+//                                     11=block (array or struct): <DTYPE> is followed by <FIELDS> (byte) and FIELDS x
+//                                     <DTYPE><COUNT> (uint16), <DATA> holds the COUNT elements of each field one after another.
+//                                     Added with addSignal(name, &array), addSignal(name, values, count) or
+//                                     addSignal(name, &struct, fields, fieldCount). Not available on I2C slaves,
+//                                     sent as plain <DATA> in B5 frames, triggers and aggregates use the first element.
+
+#define ASI_HEADER_LENGTH 12   // "#ASI:" + <MSGKEY> + ":" + <MSGID> + ":"
+#define ASI_TRAILER_LENGTH 10  // "ENDOFASI" + <CRNL>
+#define ASI_FRAMED_HEADER_LENGTH 5 // <MSGKEY> + <MSGID>
+#define ASI_ID_LENGTH 2        // <SymbolID>
+#define ASI_TIMESTAMP_LENGTH 4 // <Timestamp>
+#define ASI_EXTENDED_HEADER_LENGTH 12 // <FrameCounter><Timestamp><SymbolHash>
+
+
+enum dataType { asi_bool, asi_byte, asi_short, asi_long, asi_ushort, asi_ulong, asi_int, asi_uint, asi_float, asi_double,
+                asi_scaled8, asi_scaled16, asi_block};
+
+#define ASI_NAME_IN_FLASH 0x01  // LoggedSignal.Flags: Name points to a PROGMEM string
 
+struct LoggedSignal {
+  const char * Name;
+  void * addr;
+  byte Type;    //dataType
+  byte Flags;
+};
 
+//asi_scaled8/16: LoggedSignal.addr points to this (a descriptor slot), the value is sent as round((value - Offset) / Scale)
+struct ASIScaledValue {
+  void * addr;
+  byte SourceType;  //dataType of the variable
+  float Scale;
+  float Offset;
+};
 
-typedef enum dataType { asi_bool, asi_byte, asi_short, asi_long, asi_ushort, asi_ulong, asi_int, asi_uint, asi_float, asi_double};
-struct LoggedSignal {
-  String Name;
-  dataType Type;
+//One field of a block signal (array or struct): Count elements of Type at Offset bytes into the block
+struct ASIField {
+  byte Type;          //dataType, no scaled or block types
+  unsigned int Offset;
+  unsigned int Count;
+};
+
+//asi_block: LoggedSignal.addr points to this (a descriptor slot). The fields are sent one after another without padding.
+struct ASIBlockValue {
   void * addr;
+  const ASIField * Fields;  //the caller's layout, unused for a single field
+  ASIField Field;           //copy of a single field, the caller's may be a temporary
+  byte FieldCount;
+  unsigned int Size;  //bytes in a data frame
+
+  //Points nowhere into the descriptor itself, so the slots can be moved with memcpy
+  const ASIField & field(byte f) const { return FieldCount == 1 ? Field : Fields[f]; }
+};
+
+//Descriptor of a scaled or block signal: LoggedSignal.addr points to one of the descriptor slots,
+//so registering these signals does not allocate per signal
+union ASIDescriptor {
+  ASIScaledValue Scaled;
+  ASIBlockValue Block;
+};
+
+#define ASI_DESCRIPTOR_STEP 4 // descriptor slots AdvancedSerial adds at a time
+
+#ifndef ASI_MAX_BLOCK_FIELDS
+#define ASI_MAX_BLOCK_FIELDS 16
+#endif
+#define ASI_MAX_METADATA_LENGTH (1 + 3 * ASI_MAX_BLOCK_FIELDS) // bytes after <DTYPE> in a symbol list
+
+//Maps the variable type passed to addSignal() to its dataType at compile time.
+//Unsupported types fail to compile.
+template <typename T> struct ASIDataType;
+template <> struct ASIDataType<bool> { static const dataType value = asi_bool; };
+template <> struct ASIDataType<byte> { static const dataType value = asi_byte; };
+template <> struct ASIDataType<short> { static const dataType value = asi_short; };
+template <> struct ASIDataType<unsigned short> { static const dataType value = asi_ushort; };
+template <> struct ASIDataType<int> { static const dataType value = asi_int; };
+template <> struct ASIDataType<unsigned int> { static const dataType value = asi_uint; };
+template <> struct ASIDataType<long> { static const dataType value = asi_long; };
+template <> struct ASIDataType<unsigned long> { static const dataType value = asi_ulong; };
+template <> struct ASIDataType<float> { static const dataType value = asi_float; };
+template <> struct ASIDataType<double> { static const dataType value = asi_double; };
+
+//Type and element count of a struct member for ASI_FIELD()
+template <typename T> struct ASIFieldInfo { static const dataType Type = ASIDataType<T>::value; static const unsigned int Count = 1; };
+template <typename T, size_t N> struct ASIFieldInfo<T[N]> { static const dataType Type = ASIDataType<T>::value; static const unsigned int Count = N; };
+
+//Describes a member of a struct block signal:
+//  static const ASIField CalLayout[] = { ASI_FIELD(Calibration, gain), ASI_FIELD(Calibration, offset) }; //not copied
+//  AdvSerial.addSignal("cal", &cal, CalLayout, 2);
+#define ASI_FIELD(Struct, Member) { ASIFieldInfo<decltype(((Struct *)0)->Member)>::Type, offsetof(Struct, Member), ASIFieldInfo<decltype(((Struct *)0)->Member)>::Count }
+
+//Largest B1 frame for Size signals (every signal a double)
+#define ASI_MAX_DATA_FRAME_LENGTH(Size) (ASI_HEADER_LENGTH + ASI_EXTENDED_HEADER_LENGTH + ASI_TRAILER_LENGTH + (Size) * (ASI_ID_LENGTH + 8))
+
+//Command table: Commands are looked up by a 16 bit hash of their name, computed while
+//the COMMAND chars arrive. The built-in LOGGING_* commands are a table in flash sorted by hash
+//(binary search), this one in RAM holds the registerCommand() entries and is searched first,
+//so they can replace a built-in.
+#ifndef ASI_MAX_COMMANDS
+#define ASI_MAX_COMMANDS 8      // Power of 2
+#endif
+static_assert(ASI_MAX_COMMANDS > 0 && (ASI_MAX_COMMANDS & (ASI_MAX_COMMANDS - 1)) == 0, "ASI_MAX_COMMANDS has to be a power of 2");
+
+#ifndef ASI_MAX_RATE_GROUPS
+#define ASI_MAX_RATE_GROUPS 4   // Max. 8
+#endif
+static_assert(ASI_MAX_RATE_GROUPS > 0 && ASI_MAX_RATE_GROUPS <= 8, "ASI_MAX_RATE_GROUPS has to be 1..8");
+#define ASI_NO_RATE_GROUP 0xFF
+
+struct ASIRateGroup {
+  unsigned long Period_ms;  //0: Unused
+  unsigned long NextDue_ms;
+};
+
+#define ASI_WIRE_CHUNK_LENGTH 32 // Bytes per I2C response (Wire buffer size)
+#define ASI_WIRE_CHUNK_DATA (ASI_WIRE_CHUNK_LENGTH * 3) // <SymbolID><DATA> of one chunk, at most 1 byte values
+
+#define ASI_WIRE_FIRST_ADDRESS 0x08 // <LOGGING_DISCOVER,FIRST,LAST>: I2C addresses without reserved ones
+#define ASI_WIRE_LAST_ADDRESS 0x77
+
+#ifndef ASI_MAX_SLAVES
+#define ASI_MAX_SLAVES 8
+#endif
+
+struct ASISlave {
+  byte Address;
+  unsigned int SignalCount;
+  uint32_t SymbolHash;
+  byte * Cache;               //<SymbolID><DATA> of all its signals from the last background poll
+  unsigned int CacheSize;
+  unsigned int CacheLength;   //0: no data yet
+  unsigned long CacheTime_ms; //millis() when Cache was completed
+};
+
+enum asiPollState { asi_poll_idle, asi_poll_discover, asi_poll_select, asi_poll_read };
+
+#define ASI_SYMBOL_HASH_INIT 2166136261UL  // FNV-1a offset basis
+
+#ifndef ASI_STATS
+#define ASI_STATS 1             // 0: no statistics, counters and timers compile to nothing
+#endif
+
+//ASI_STATS, ASI_MAX_COMMANDS, ASI_MAX_RATE_GROUPS and ASI_MAX_SLAVES change the layout of
+//AdvancedSerial, so the sketch and AdvancedSerial.cpp have to see the same values: Set them as
+//build flags (plain numbers, e.g. -DASI_MAX_SLAVES=4 in build_flags / platform.local.txt), not with
+//#define before the #include. The constructor references a symbol named after the values, so a
+//mismatch fails to link (undefined asi_config_...) instead of corrupting memory.
+#define ASI_CONFIG_NAME2(Stats, Commands, RateGroups, Slaves) asi_config_s##Stats##_c##Commands##_r##RateGroups##_m##Slaves
+#define ASI_CONFIG_NAME(Stats, Commands, RateGroups, Slaves) ASI_CONFIG_NAME2(Stats, Commands, RateGroups, Slaves)
+#define ASI_CONFIG ASI_CONFIG_NAME(ASI_STATS, ASI_MAX_COMMANDS, ASI_MAX_RATE_GROUPS, ASI_MAX_SLAVES)
+extern const byte ASI_CONFIG;
+
+struct ASITimer {
+  unsigned long Count;
+  unsigned long Min;
+  unsigned long Max;
+  unsigned long Total; //average = Total / Count
+};
+
+struct ASIStats {
+  unsigned long BytesSent;        //bytes of all frames handed to the stream or the transmit buffer
+  unsigned long FramesSent;
+  unsigned long CommandsReceived;
+  unsigned long WireRetries;      //repeated I2C mode selects
+  unsigned long WireEmpty;        //requestFrom() without a valid response
+  ASITimer Transmit_us;           //txBeginFrame() .. txEndFrame() of a frame
+  ASITimer Command_us;            //echo, handler and callbacks of a received command
+  ASITimer Wire_us;               //master: one data collection or poll step, slave: one Wire handler
+  ASITimer IntervalLate_ms;       //how late TransmitDataInterval() / a rate group fired
+};
+
+#if ASI_STATS
+#define ASI_STAT_ADD(Counter, N) (Stats.Counter += (N))
+#define ASI_TIMER_START(Start) unsigned long Start = micros()
+#define ASI_TIMER_STOP(Timer, Start) addTiming(Stats.Timer, micros() - (Start))
+#define ASI_TIMING(Timer, Value) addTiming(Stats.Timer, (Value))
+#else
+#define ASI_STAT_ADD(Counter, N) do {} while (0)
+#define ASI_TIMER_START(Start) do {} while (0)
+#define ASI_TIMER_STOP(Timer, Start) do {} while (0)
+#define ASI_TIMING(Timer, Value) do {} while (0)
+#endif
+
+enum asiTriggerState { asi_trigger_off, asi_trigger_armed, asi_trigger_post, asi_trigger_captured };
+#define ASI_TRIGGER_RISING 0x01
+#define ASI_TRIGGER_FALLING 0x02
+
+class AdvancedSerial;
+typedef bool (*ASITriggerPredicate)(AdvancedSerial * asi);
+typedef void (*ASICommandHandler)(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+
+struct ASICommand {
+  const char * Name;
+  ASICommandHandler Handler;
+  uint16_t Hash;
+  byte Flags;   //ASI_NAME_IN_FLASH
+};
+
+//Built-in command in PROGMEM, Hash is computed by the compiler
+struct ASIBuiltinCommand {
+  char Name[24];
+  ASICommandHandler Handler;
+  uint16_t Hash;
 };
 
+//djb2 hash of a command name, the same as AdvancedSerial::hashChar() computes while it arrives
+constexpr uint16_t asiCommandHash(const char * name, uint16_t hash = 5381) {
+  return *name == '\0' ? hash : asiCommandHash(name + 1, (uint16_t)((hash << 5) + hash + (byte)*name));
+}
+
 class AdvancedSerial {
 
     //variables
   public:
   private:
-    unsigned int maxSignalCount;
+    unsigned int maxSignalCount = 0;
     unsigned int signalCount = 0;
     unsigned int wireSignalCount = 0;
 
-    LoggedSignal * Signals;
-    String SlaveSymbolPrefix;
-    HardwareSerial *SerialRef;
-    int PARAMETER[10];
+    LoggedSignal * Signals = 0;
+    bool StaticStorage = false;
+    //StaticStorage: Signals and FrameBuffer are provided by AdvancedSerialStatic<N>, never (re)allocated
+    byte * FrameBuffer = 0;
+    unsigned int FrameBufferSize = 0;
+    unsigned int DataFrameLength = ASI_HEADER_LENGTH + ASI_TRAILER_LENGTH;
+    //DataFrameLength: Length of a complete B1 frame for the registered signals,
+    //updated in addSignal() so TransmitData() can assemble the frame in FrameBuffer
+    bool FrameTimestamps = false;
+    unsigned long FrameCounter = 0;
+    //FrameTimestamps: Data frames carry <FrameCounter><Timestamp><SymbolHash>, negotiated with LOGGING_TIMESTAMPS
+
+    byte * TxBuffer = 0;
+    unsigned int TxBufferSize = 0;
+    unsigned int TxHead = 0;
+    unsigned int TxTail = 0;
+    unsigned int TxWriteHead = 0;
+    bool TxBufferOwned = false;
+    bool TxWriteAll = false;
+    byte TxFrameDepth = 0;
+    bool TxFrameOverflow = false;
+    unsigned long TxFramesDropped = 0;
+    unsigned int TxFrameBytes = 0;
+    unsigned long TxFrameStart_us = 0;
+    //Async transmit: Frames are queued in the TxBuffer ring and drained with
+    //availableForWrite() from Read(), TransmitDataInterval() and update().
+    //A frame that does not fit completely is dropped and counted in TxFramesDropped.
+    //TxWriteAll: The stream has no availableForWrite(), the ring is written at once
+
+    byte * CobsBuffer = 0;
+    unsigned int CobsBufferSize = 0;
+    unsigned int CobsLength = 0;
+    unsigned int CobsCode = 0;
+    uint16_t FrameCrc = 0xFFFF;
+    unsigned int FramePayloadLength = 0;
+    //CobsBuffer: Framed transmit is on while allocated, the packet is COBS encoded into it and
+    //handed over with one write in txEndFrame(). CobsCode: Position of the open block's code byte
+
+    byte * DeltaShadow = 0;
+    unsigned int DeltaShadowSize = 0;
+    unsigned int DeltaKeyframeInterval = 0;
+    unsigned int DeltaFramesSinceKeyframe = 0;
+    bool DeltaKeyframeDue = true;
+    bool CompressedFrames = false;
+    //DeltaShadow: Value bytes of all signals as the host knows them from the last B1/B2/B5 frame
+
+    byte * Aggregates = 0;
+    unsigned int AggregatesSize = 0;
+    unsigned long AggregateCount = 0;
+    bool AggregateFrames = false;
+    //Aggregates: float <Min><Max><Sum> per signal since the last B8 frame, AggregateCount accumulate() calls
+
+    ASIDescriptor * Descriptors = 0;
+    unsigned int DescriptorCapacity = 0;
+    unsigned int DescriptorCount = 0;
+    //Descriptors: Slots of the scaled and block signals in addSignal() order. Grown by ASI_DESCRIPTOR_STEP
+    //slots when used up, or provided by AdvancedSerialStatic (never allocated)
+
+    char SlaveSymbolPrefix[6] = "";
+    //SlaveSymbolPrefix: "S<SLAVE_ID>_", put in front of the signal names in slave mode
+    Stream *SerialRef;
+    long PARAMETER[10];
+    byte ParameterCount = 0;
     char COMMAND[64] = {0};
     char STRING_01[16];
     //STRING_01: Max. 15 chars allowed  + Null Terminator '\0' = 16
-    //In case more than 15 chars are sent, the rest is cut off in function void parseData()
+    //In case more than 15 chars are sent, the rest is cut off in function parseChar()
     const int numChars = 64;
     char receivedChars[64];
 
+    byte RxState = 0;
+    byte RxIndex = 0;
+    byte RxTokenLength = 0;
+    bool RxNegative = false;
+    bool RxConverting = true;
+    bool RxTruncated = false;
+    unsigned long CommandsTruncated = 0;
+    //RxState = 0: Waiting for '<'
+    //RxState = 1: Receiving COMMAND
+    //RxState = 2: Receiving PARAMETER[ParameterCount]
+    //Commands are tokenized and the parameters converted while the chars arrive (parseChar()),
+    //receivedChars only keeps the first 63 chars for the echo
+
+    ASICommand Commands[ASI_MAX_COMMANDS];
+    static const ASIBuiltinCommand BuiltinCommands[];
+#if ASI_STATS
+    ASIStats Stats;
+    static void addTiming(ASITimer & timer, unsigned long value);
+    static void cmdStats(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+#endif
+    uint16_t CommandHash = 0;
+    bool CommandEcho = true;
+    //CommandEcho: Echo every received command as <receivedChars> to SerialRef
+
+    byte * SubscriptionGroup = 0;
+    ASIRateGroup RateGroups[ASI_MAX_RATE_GROUPS] = {};
+    byte RateGroupCount = 0;
+    //SubscriptionGroup[SymbolID]: Index into RateGroups or ASI_NO_RATE_GROUP,
+    //allocated with maxSignalCount entries on the first subscription
+
+    byte * SampleBuffer = 0;
+    unsigned int SampleBufferSize = 0;
+    bool SampleBufferOwned = false;
+    unsigned int SampleLength = 0;
+    unsigned int SampleCapacity = 0;
+    volatile unsigned int SampleHead = 0;
+    unsigned int SampleTail = 0;
+    volatile unsigned int SampleCount = 0;
+    volatile unsigned long SamplesDropped = 0;
+    //SampleBuffer: Ring of SampleCapacity snapshots <Timestamp><DATA_1>..<DATA_K>, SampleLength bytes each.
+    //sample() (maybe in an ISR) only writes SampleHead, TransmitBurst() only SampleTail
+    volatile byte TriggerState = asi_trigger_off;
+    unsigned int TriggerSignal = 0;
+    float TriggerThreshold = 0;
+    byte TriggerEdge = 0;
+    ASITriggerPredicate TriggerPredicate = 0;
+    unsigned int TriggerPre = 0;
+    volatile unsigned int TriggerPostRemaining = 0;
+    volatile unsigned int TriggerIndex = 0;
+    float TriggerLastValue = 0;
+    bool TriggerHasLast = false;
+    unsigned long TriggerMessageID = 0;
+    unsigned long SamplePeriod_us = 0;
+    unsigned long SampleNextDue_us = 0;
+    //Trigger*: While a capture is armed or running (asi_trigger_armed, asi_trigger_post), sample()
+    //also moves SampleTail and overwrites the oldest snapshot. TriggerIndex: Position of the trigger
+    //snapshot counted from SampleTail, TriggerPostRemaining: snapshots still to record behind it
+
     bool LoggingActivated = true;
     bool LoggingFirstTime = true;
     unsigned long LoggingFirstTimeDone_ms = 0;
@@ -74,7 +516,14 @@ class AdvancedSerial {
     unsigned long LoggingInterval_ms = 1000;
     byte LOGGING_MODE = 0;
     byte SLAVE_ID;
-    bool SLAVE_FOUND[128];
+    ASISlave Slaves[ASI_MAX_SLAVES];
+    byte SlaveCount = 0;
+    bool SlavesDiscovered = false;
+    //Slaves: I2C slaves found by discoverSlaves(), sorted by address. Symbol and data
+    //requests only go to these, the bus is scanned on the first LOGGING_GETSIGNALLIST
+    //or on demand (LOGGING_DISCOVER)
+    uint32_t SymbolHash = ASI_SYMBOL_HASH_INIT;
+    //SymbolHash: Hash over the names and types of all signals, extended in addSignal()
     byte WireMode = 0;
     //LOGGING_MODE = 0: SINGLE DEVICE
     //LOGGING_MODE = 1: MASTER
@@ -82,51 +531,250 @@ class AdvancedSerial {
     //MASTER/SLAVE logging mode uses I2C (Wire) interface
     //e.g. Pins 20 (SDA) and 21 (SCL) on Arduino Mega
 
+    byte * WireSnapshot = 0;
+    unsigned int WireSnapshotSize = 0;
+    unsigned int WireSnapshotLength = 0;
+    volatile unsigned int WireSnapshotSignals = 0;
+    volatile byte WireSnapshotFront = 0;
+    volatile byte WireSnapshotReading = 0xFF;
+    unsigned int WireReadOffset = 0;
+    volatile bool WireSyncRequested = false;
+    volatile bool WireLatched = false;
+    //WireSnapshot: Two halves of WireSnapshotLength packed value bytes, filled by publishSnapshot().
+    //The Wire handlers answer from the WireSnapshotFront half, a master read locks it in
+    //WireSnapshotReading (0xFF: none) so the next publish never overwrites it. No snapshot
+    //published yet (WireSnapshotSignals = 0): values are read live in the handler.
+    //WireLatched: The front half was taken by a latch, publishSnapshot() keeps it until the master read it
+
+    unsigned long PollInterval_ms = 0;
+    unsigned long PollCycleStart_ms = 0;
+    byte PollState = asi_poll_idle;
+    byte PollSlave = 0;
+    byte PollAddress = 1;
+    byte PollRetries = 0;
+    unsigned int PollRequests = 0;
+    unsigned int PollReceived = 0;
+    byte * PollBuffer = 0;
+    unsigned int PollBufferSize = 0;
+    unsigned int PollLength = 0;
+    //Poll*: Background polling of the slaves (master), see pollStep(). PollSlave is the index into
+    //Slaves, PollBuffer collects its chunks and is swapped with Slaves[PollSlave].Cache when complete
+
 
     //functions
   public:
-    AdvancedSerial();
+    AdvancedSerial() {
+      construct(ASI_CONFIG);
+    }
     ~AdvancedSerial();
 
-    void begin(HardwareSerial *Ref, unsigned int Size);
-    void begin(HardwareSerial *Ref, unsigned int Size, uint32_t WireClockFrequency, bool isMaster, byte SlaveID);
+    void begin(Stream *Ref, unsigned int Size);
+    void begin(Stream *Ref, unsigned int Size, uint32_t WireClockFrequency, bool isMaster, byte SlaveID);
 
     void setCommandCallback(void (*readCallback)(char * command, int * parameter, char * string_01));
+    void setCommandCallback(void (*readCallback)(char * command, long * parameter, byte parameterCount, char * string_01));
+    bool registerCommand(const char * name, ASICommandHandler handler);
+    bool registerCommand(const __FlashStringHelper * name, ASICommandHandler handler);
+    void setCommandEcho(bool echo);
     void setInitialIntervalSettings(bool loggingactivated, unsigned long logginginterval_ms);
-    void addSignal(String Name, bool * value);
-    void addSignal(String Name, byte * value);
-    void addSignal(String Name, float * value);
-    void addSignal(String Name, double * value);
-    void addSignal(String Name, unsigned long * value);
-    void addSignal(String Name, int * value);
+    bool setAsyncTransmit(unsigned int bufferSize, bool writeAll = false);
+    bool setAsyncTransmit(byte * buffer, unsigned int bufferSize, bool writeAll = false);
+    unsigned long getDroppedFrames();
+#if ASI_STATS
+    const ASIStats & getStats();
+    void resetStats();
+    void TransmitStats(unsigned long MessageID);
+#endif
+    bool setFramedTransmit(bool enable);
+    void update();
+
+    //Name has to stay valid while the signal is registered (e.g. a string literal).
+    //Use F("name") to keep the name in flash.
+    //&array of a fixed length array registers it as one block signal (see ASIBlockValue).
+    template <typename T> bool addSignal(const char * Name, T * value) {
+      return registerValue(Name, value, 0);
+    }
+    template <typename T> bool addSignal(const __FlashStringHelper * Name, T * value) {
+      return registerValue((const char *)Name, value, ASI_NAME_IN_FLASH);
+    }
+    //Block of count elements starting at values
+    template <typename T> bool addSignal(const char * Name, T * values, unsigned int count) {
+      ASIField field = { ASIDataType<T>::value, 0, count };
+      return registerBlock(Name, values, &field, 1, 0);
+    }
+    template <typename T> bool addSignal(const __FlashStringHelper * Name, T * values, unsigned int count) {
+      ASIField field = { ASIDataType<T>::value, 0, count };
+      return registerBlock((const char *)Name, values, &field, 1, ASI_NAME_IN_FLASH);
+    }
+    //Struct with the layout described by fields, see ASI_FIELD(). fields is not copied, it has to stay
+    //valid while the signal is registered (e.g. a static const array). Blocks take a descriptor slot
+    template <typename S> bool addSignal(const char * Name, S * value, const ASIField * fields, byte fieldCount) {
+      return registerBlock(Name, value, fields, fieldCount, 0);
+    }
+    template <typename S> bool addSignal(const __FlashStringHelper * Name, S * value, const ASIField * fields, byte fieldCount) {
+      return registerBlock((const char *)Name, value, fields, fieldCount, ASI_NAME_IN_FLASH);
+    }
+    //Scaled: sent as int16 (bits = 8: int8) raw value, value = raw * scale + offset on the host.
+    //Takes a descriptor slot (AdvancedSerialStatic: DescriptorSlots)
+    template <typename T> bool addSignal(const char * Name, T * value, float scale, float offset, byte bits = 16) {
+      return registerScaled(Name, ASIDataType<T>::value, value, 0, scale, offset, bits);
+    }
+    template <typename T> bool addSignal(const __FlashStringHelper * Name, T * value, float scale, float offset, byte bits = 16) {
+      return registerScaled((const char *)Name, ASIDataType<T>::value, value, ASI_NAME_IN_FLASH, scale, offset, bits);
+    }
     void deleteSignals();
     void Read();
     void TransmitSymbols(unsigned long MessageID, bool send_eol);
     void TransmitData(unsigned long MessageID, bool send_eol);
+    void setFrameTimestamps(bool enable);
+    uint32_t getSymbolHash();
+    void TransmitSymbolHash(unsigned long MessageID);
+    void setDeltaFrames(unsigned int keyframeInterval);
+    void TransmitDeltaData(unsigned long MessageID, bool send_eol);
+    void setCompressedFrames(unsigned int keyframeInterval);
+    void TransmitCompressedData(unsigned long MessageID, bool send_eol);
+    bool setAggregateFrames(bool enable);
+    void accumulate();
+    void TransmitAggregates(unsigned long MessageID, bool send_eol);
+    bool subscribeSignal(unsigned int SymbolID, unsigned long period_ms);
+    void unsubscribeSignal(unsigned int SymbolID);
+    void unsubscribeAll();
+    void TransmitScheduledData(unsigned long MessageID, bool send_eol);
+    bool setSampleBuffer(unsigned int sampleCount);
+    bool setSampleBuffer(byte * buffer, unsigned int bufferSize);
+    bool sample();
+    unsigned int getSampleCount();
+    unsigned long getDroppedSamples();
+    void TransmitBurst(unsigned long MessageID, bool send_eol, unsigned int maxSamples);
+    bool setTrigger(unsigned int SymbolID, float threshold, byte edge, unsigned int preSamples, unsigned long MessageID);
+    bool setTrigger(ASITriggerPredicate predicate, unsigned int preSamples, unsigned long MessageID);
+    void clearTrigger();
+    bool isCaptureComplete();
+    void setSamplePeriod(unsigned long period_us);
     void WireTransmitSymbols(unsigned long MessageID, bool send_eol);
     void WireTransmitData(unsigned long MessageID, bool send_eol);
     void TransmitDataInterval(unsigned long MessageID, bool send_eol);
+    byte discoverSlaves(byte firstAddress, byte lastAddress);
+    byte getSlaveCount();
+    void syncSlaves();
+    void latchSlaves();
+    void setBackgroundPolling(unsigned long interval_ms);
+    void TransmitSlaveAges(unsigned long MessageID);
+    bool publishSnapshot();
+    //Slave side of a Wire transfer, called by the handlers beginWire() installs on Wire. Own handlers
+    //call them for another bus (e.g. Wire1) or to run several slave instances on a simulated bus.
+    void WireSlaveReceive();
+    void WireSlaveTransmitToMaster();
+
+  protected:
+    void beginWire(uint32_t WireClockFrequency, bool isMaster, byte SlaveID);
+    void construct(byte config);
+    void attachStorage(Stream *Ref, LoggedSignal * signals, unsigned int Size, byte * frameBuffer, unsigned int frameBufferSize,
+                       ASIDescriptor * descriptors, unsigned int descriptorCount);
 
   private:
-    static AdvancedSerial* pSingletonInstance;
+    //The Wire callbacks take no context, WireSlaveInstance is the instance that called beginWire() as slave
+    static AdvancedSerial* WireSlaveInstance;
 
-    static void OnReceiveHandler() {
-      if (pSingletonInstance)
-        pSingletonInstance->WireSlaveTransmitToMaster();
+    static void OnRequestHandler() {
+      if (WireSlaveInstance)
+        WireSlaveInstance->WireSlaveTransmitToMaster();
     }
 
-    static void OnSendHandler() {
-      if (pSingletonInstance)
-        pSingletonInstance->WireSlaveReceive();
+    static void OnReceiveHandler(int) {
+      if (WireSlaveInstance)
+        WireSlaveInstance->WireSlaveReceive();
     }
 
-    void WireSlaveTransmitToMaster();
-    void WireSlaveReceive();
     void WireSlaveTransmitSingleSymbol();
     void WireSlaveTransmitSingleDataPoint();
-    void (*_readCallback)(char * command, int * parameter, char * string01);
+    void WireSlaveTransmitInfo();
+    void WireSlaveTransmitPacked();
+    bool wireSelectMode(byte address, byte mode);
+    bool probeSlave(byte address);
+    bool packSnapshot();
+    void republishSnapshot();
+    int wireReadChunk(byte address, unsigned int firstID, unsigned int & received, unsigned int expected, byte * dst, bool & last);
+    void pollNextSlave();
+    void pollStep();
+    void updateSymbolHash(const LoggedSignal & sym);
+    void (*_readCallback)(char * command, int * parameter, char * string01) = 0;
+    void (*_readCallbackLong)(char * command, long * parameter, byte parameterCount, char * string01) = 0;
     bool recvWithStartEndMarkers();
-    void parseData();
+    bool parseChar(char rc);
+    void parseToken();
+    bool addCommand(const char * name, byte flags, ASICommandHandler handler);
+    static bool sameCommandName(const char * a, byte aFlags, const char * b, byte bFlags);
+    ASICommandHandler findCommand();
+    static uint16_t hashChar(uint16_t hash, char c);
+    static unsigned long messageID(long * parameter);
+    static void cmdGetSignalList(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdGetData(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdGetDelta(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdSetDelta(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdActivate(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdDeactivate(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdActivateMs(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdSubscribe(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdSubscribeRange(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdUnsubscribe(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    void releaseRateGroups();
+    static void cmdTimestamps(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdSetCompressed(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdGetCompressed(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdFraming(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdGetHash(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdLatch(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdDiscover(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdSetAggregate(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdGetAggregate(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdGetBurst(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    static void cmdTrigger(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01);
+    bool registerSignal(const char * Name, dataType Type, void * value, byte Flags);
+    template <typename T> bool registerValue(const char * Name, T * value, byte Flags) {
+      return registerSignal(Name, ASIDataType<T>::value, value, Flags);
+    }
+    template <typename T, size_t N> bool registerValue(const char * Name, T (*values)[N], byte Flags) {
+      ASIField field = { ASIDataType<T>::value, 0, N };
+      return registerBlock(Name, *values, &field, 1, Flags);
+    }
+    bool registerBlock(const char * Name, void * value, const ASIField * fields, byte fieldCount, byte Flags);
+    static unsigned int signalSize(const LoggedSignal & sym);
+    void updateDeltaShadow(const byte * entries, const byte * end, bool sent);
+    bool registerScaled(const char * Name, dataType Type, void * value, byte Flags, float scale, float offset, byte bits);
+    ASIDescriptor * reserveDescriptor();
+    static byte packMetadata(byte * dst, const LoggedSignal & sym);
+    static byte metadataLength(byte typeCode);
+    byte copyName(char * dst, byte size, const LoggedSignal & sym);
+    bool reserveFrameBuffer();
+    bool reserveBuffer(byte *& buffer, unsigned int & bufferSize, unsigned int length);
+    void txBeginFrame();
+    void txWrite(const byte * data, unsigned int length);
+    void txWrite(byte c);
+    void txWriteRaw(const byte * data, unsigned int length);
+    void txTrailer();
+    void cobsPut(byte c);
+    void cobsEndBlock();
+    void cobsWrite(const byte * data, unsigned int length);
+    void cobsReserve(unsigned int count);
+    static uint16_t crc16(uint16_t crc, byte c);
+    bool txEndFrame(bool flush = true);
+    void txDrain();
+    unsigned int txFrameLength(unsigned int length);
+    unsigned int txFree();
+    byte * packHeader(byte * dst, byte msg_key, unsigned long msg_id);
+    byte * packDataHeader(byte * dst, byte msg_key, unsigned long msg_id);
+    byte * packTrailer(byte * dst);
+    static unsigned int packValue(byte * dst, const LoggedSignal & sym);
+    static byte packCompressed(byte * dst, const byte * value, const byte * previous, byte type);
+    void transmitDelta(unsigned long MessageID, bool send_eol, bool compressed);
+    unsigned int valueLength();
+    void resetSampleBuffer();
+    bool reserveAggregates();
+    void armTrigger(unsigned int preSamples, unsigned long MessageID);
+    bool checkTrigger();
+    void transmitSamples(byte msg_key, unsigned long msg_id, bool send_eol, unsigned int maxSamples);
+    static float signalValue(const LoggedSignal & sym);
 
 
     union {
@@ -172,5 +820,39 @@ class AdvancedSerial {
 }; //AdvancedSerial
 
 
+//Descriptor slots of AdvancedSerialStatic, none for DescriptorSlots = 0
+template <unsigned int D> struct ASIDescriptorStorage {
+  ASIDescriptor Slots[D];
+  ASIDescriptor * slots() { return Slots; }
+};
+template <> struct ASIDescriptorStorage<0> {
+  ASIDescriptor * slots() { return 0; }
+};
+
+//AdvancedSerial with a compile-time sized signal registry in static storage.
+//No heap is used for the N signals and the B1 frame buffer, BlockBytes reserves frame room
+//for block signals (bytes beyond 8 per signal), DescriptorSlots is the number of scaled and block
+//signals. addSignal() returns false for a signal that doesn't fit:
+//  AdvancedSerialStatic<20> AdvSerial;
+//  AdvSerial.begin(&Serial);
+//  AdvSerial.addSignal(F("sine"), &sine_value);
+template <unsigned int N, unsigned int BlockBytes = 0, unsigned int DescriptorSlots = 0>
+class AdvancedSerialStatic : public AdvancedSerial {
+  public:
+    void begin(Stream *Ref) {
+      attachStorage(Ref, SignalStorage, N, FrameStorage, sizeof(FrameStorage), DescriptorStorage.slots(), DescriptorSlots);
+    }
+    void begin(Stream *Ref, uint32_t WireClockFrequency, bool isMaster, byte SlaveID) {
+      beginWire(WireClockFrequency, isMaster, SlaveID);
+      begin(Ref);
+    }
+
+  private:
+    LoggedSignal SignalStorage[N];
+    byte FrameStorage[ASI_MAX_DATA_FRAME_LENGTH(N) + BlockBytes];
+    ASIDescriptorStorage<DescriptorSlots> DescriptorStorage;
+};
+
+
 
 #endif //  ADVANCEDSERIAL_H
\ No newline at end of file
@@ -17,9 +17,10 @@ void setup() {
   Serial.begin(9600);
   AdvSerial.begin(&Serial, 100);
   //Add signals to Advanced Serial which will be transmitted
-  AdvSerial.addSignal("sine", &sine_value);
-  AdvSerial.addSignal("cosine", &cosine_value);
-  AdvSerial.addSignal("square", &square_value);
+  //F(): the signal names stay in flash and use no RAM
+  AdvSerial.addSignal(F("sine"), &sine_value);
+  AdvSerial.addSignal(F("cosine"), &cosine_value);
+  AdvSerial.addSignal(F("square"), &square_value);
 }
 
 void loop() {
@@ -0,0 +1,211 @@
+/*
+        File: AdvancedSerialBench.cpp
+        Description: Host benchmark of the frame paths. Reports per frame the time, the number
+                     of write() calls on the stream and the bytes sent, for I2C also the
+                     transactions and bytes on the bus.
+        Usage: asi_bench [--quick] [--csv]
+*/
+
+#include "AdvancedSerial.h"
+#include <chrono>
+#include <memory>
+
+enum BenchMix { mix_float, mix_mixed, mix_scaled, mix_block };
+static const char * const MIX_NAMES[] = { "float", "mixed", "scaled16", "block" };
+
+enum BenchOp { op_data, op_framed, op_async, op_delta, op_compressed, op_symbols, op_command, op_wire };
+static const char * const OP_NAMES[] = { "B1", "B1 framed", "B1 async", "B2 delta", "B5 compressed", "B0 symbols",
+                                         "GETDATA cmd", "I2C B1" };
+
+static bool Quick = false;
+static bool Csv = false;
+
+//Values of one benchmark case, changed a little between frames
+struct BenchSignals {
+  std::vector<std::string> Names;
+  std::vector<byte> Bytes;
+  std::vector<int> Ints;
+  std::vector<long> Longs;
+  std::vector<float> Floats;
+  std::vector<double> Doubles;
+  unsigned int Count = 0;
+  unsigned long Step = 0;
+
+  void registerOn(AdvancedSerial & asi, BenchMix mix, unsigned int count) {
+    Count = count;
+    Names.resize(count);
+    Bytes.assign(count, 0);
+    Ints.assign(count, 0);
+    Longs.assign(count, 0);
+    Floats.assign(count, 0);
+    Doubles.assign(count, 0);
+    for (unsigned int i = 0; i < count; i++) {
+      Names[i] = "signal_" + std::to_string(i);
+      Floats[i] = i * 0.25f;
+    }
+    if (mix == mix_block) {
+      asi.addSignal("block", Floats.data(), count);
+      return;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+      const char * name = Names[i].c_str();
+      if (mix == mix_float) {
+        asi.addSignal(name, &Floats[i]);
+      } else if (mix == mix_scaled) {
+        asi.addSignal(name, &Floats[i], 0.01f, 0.0f);
+      } else {
+        switch (i % 5) {
+          case 0: asi.addSignal(name, &Bytes[i]); break;
+          case 1: asi.addSignal(name, &Ints[i]); break;
+          case 2: asi.addSignal(name, &Longs[i]); break;
+          case 3: asi.addSignal(name, &Floats[i]); break;
+          default: asi.addSignal(name, &Doubles[i]); break;
+        }
+      }
+    }
+  }
+
+  //About one signal in eight changes per frame, like slowly moving sensor values
+  void change() {
+    Step++;
+    for (unsigned int i = Step % 8; i < Count; i += 8) {
+      Bytes[i]++;
+      Ints[i] += 3;
+      Longs[i] -= 7;
+      Floats[i] += 0.5f;
+      Doubles[i] += 0.125;
+    }
+  }
+};
+
+struct BenchResult {
+  double ns_per_frame;
+  double writes_per_frame;
+  double bytes_per_frame;
+  double transactions_per_frame;
+  double bus_bytes_per_frame;
+};
+
+static const byte BENCH_SLAVE_ADDRESS = 9;
+
+//One measured frame of op
+static void runOp(BenchOp op, AdvancedSerial * asi, unsigned long id) {
+  switch (op) {
+    case op_data:
+    case op_framed:
+      asi->TransmitData(id, true);
+      break;
+    case op_async:
+      asi->TransmitData(id, true);
+      asi->update(); //drains the ring in availableForWrite() sized writes
+      break;
+    case op_delta:
+      asi->TransmitDeltaData(id, true);
+      break;
+    case op_compressed:
+      asi->TransmitCompressedData(id, true);
+      break;
+    case op_symbols:
+      asi->TransmitSymbols(id, true);
+      break;
+    case op_command:
+      Serial.feed("<LOGGING_GETDATA,1>");
+      asi->Read();
+      break;
+    case op_wire:
+      asi->WireTransmitData(id, true);
+      break;
+  }
+}
+
+static BenchResult runCase(BenchOp op, BenchMix mix, unsigned int count) {
+  BenchSignals signals;
+  std::unique_ptr<AdvancedSerial> asi(new AdvancedSerial());
+  std::unique_ptr<AdvancedSerial> slave;
+  HardwareSerial slaveSerial;
+
+  Serial.clear();
+  Serial.Record = false;
+  Wire.resetCounters();
+
+  if (op == op_wire) {
+    //The slave holds the signals, the master reads them over the in-process Wire
+    slave.reset(new AdvancedSerial());
+    slaveSerial.Record = false;
+    slave->begin(&slaveSerial, count, 400000, false, BENCH_SLAVE_ADDRESS);
+    signals.registerOn(*slave, mix, count);
+    asi->begin(&Serial, 1, 400000, true, 0);
+    asi->discoverSlaves(BENCH_SLAVE_ADDRESS, BENCH_SLAVE_ADDRESS);
+  } else {
+    asi->begin(&Serial, count);
+    signals.registerOn(*asi, mix, count);
+  }
+
+  if (op == op_framed) asi->setFramedTransmit(true);
+  if (op == op_async) asi->setAsyncTransmit(4096);
+  if (op == op_delta) asi->setDeltaFrames(100);
+  if (op == op_compressed) asi->setCompressedFrames(100);
+  if (op == op_command) asi->setCommandEcho(false);
+
+  //Warm up with the measured operation: buffers are allocated and B2/B5 have sent their keyframe
+  for (int i = 0; i < 3; i++) runOp(op, asi.get(), 1);
+  Serial.clear();
+  Wire.resetCounters();
+
+  unsigned long minFrames = Quick ? 20 : 200;
+  double minSeconds = Quick ? 0.005 : 0.2;
+  unsigned long frames = 0;
+  auto start = std::chrono::steady_clock::now();
+  double elapsed = 0;
+  while (frames < minFrames || elapsed < minSeconds) {
+    for (int batch = 0; batch < 16; batch++, frames++) {
+      signals.change();
+      runOp(op, asi.get(), frames);
+    }
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  BenchResult result;
+  result.ns_per_frame = elapsed * 1e9 / frames;
+  result.writes_per_frame = (double)Serial.WriteCalls / frames;
+  result.bytes_per_frame = (double)Serial.BytesWritten / frames;
+  result.transactions_per_frame = (double)Wire.Counters.Transactions / frames;
+  result.bus_bytes_per_frame = (double)Wire.Counters.BytesOnBus / frames;
+  return result;
+}
+
+int main(int argc, char ** argv) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--quick") == 0) Quick = true;
+    if (strcmp(argv[i], "--csv") == 0) Csv = true;
+  }
+
+  static const unsigned int COUNTS[] = { 1, 8, 32, 128 };
+  static const BenchOp OPS[] = { op_data, op_framed, op_async, op_delta, op_compressed, op_symbols, op_command, op_wire };
+
+  if (Csv) {
+    printf("op,mix,signals,ns_per_frame,writes_per_frame,bytes_per_frame,i2c_transactions_per_frame,i2c_bytes_per_frame\n");
+  } else {
+    printf("%-14s %-9s %7s %12s %13s %12s %10s %10s\n", "op", "mix", "signals", "ns/frame", "writes/frame", "bytes/frame",
+           "i2c trans", "i2c bytes");
+  }
+
+  for (BenchOp op : OPS) {
+    for (int m = mix_float; m <= mix_block; m++) {
+      BenchMix mix = (BenchMix)m;
+      //Blocks do not go over I2C (see registerBlock())
+      if (op == op_wire && mix == mix_block) continue;
+      for (unsigned int count : COUNTS) {
+        BenchResult r = runCase(op, mix, count);
+        if (Csv) {
+          printf("%s,%s,%u,%.1f,%.2f,%.1f,%.2f,%.1f\n", OP_NAMES[op], MIX_NAMES[mix], count, r.ns_per_frame,
+                 r.writes_per_frame, r.bytes_per_frame, r.transactions_per_frame, r.bus_bytes_per_frame);
+        } else {
+          printf("%-14s %-9s %7u %12.1f %13.2f %12.1f %10.2f %10.1f\n", OP_NAMES[op], MIX_NAMES[mix], count,
+                 r.ns_per_frame, r.writes_per_frame, r.bytes_per_frame, r.transactions_per_frame, r.bus_bytes_per_frame);
+        }
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,53 @@
+#include "Arduino.h"
+
+HardwareSerial Serial;
+
+static uint64_t MockNanos = 0;
+
+unsigned long millis() {
+  return (unsigned long)(MockNanos / 1000000);
+}
+
+unsigned long micros() {
+  return (unsigned long)(MockNanos / 1000);
+}
+
+void mockAdvanceMicros(unsigned long us) {
+  MockNanos += (uint64_t)us * 1000;
+}
+
+void mockAdvanceNanos(uint64_t ns) {
+  MockNanos += ns;
+}
+
+void mockSetMicros(unsigned long us) {
+  MockNanos = (uint64_t)us * 1000;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  WriteCalls++;
+  BytesWritten++;
+  if (Record) Output.push_back(c);
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t * buffer, size_t size) {
+  WriteCalls++;
+  BytesWritten += size;
+  if (Record) Output.insert(Output.end(), buffer, buffer + size);
+  return size;
+}
+
+void HardwareSerial::feed(const char * text) {
+  //Drop what was already read so the queue does not grow in long runs
+  Input.erase(0, InputPos);
+  InputPos = 0;
+  Input += text;
+}
+
+void HardwareSerial::clear() {
+  Output.clear();
+  WriteCalls = 0;
+  BytesWritten = 0;
+  FlushCalls = 0;
+}
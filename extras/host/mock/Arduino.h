@@ -0,0 +1,104 @@
+/*
+        File: Arduino.h (host stand-in)
+        Description: Just enough of the Arduino core to compile AdvancedSerial on a PC.
+                     Time is simulated, Serial records what the library writes.
+*/
+
+#ifndef ASI_HOST_ARDUINO_H
+#define ASI_HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+//Time only moves when the host program advances it, so runs are repeatable
+unsigned long millis();
+unsigned long micros();
+void mockAdvanceMicros(unsigned long us);
+void mockAdvanceNanos(uint64_t ns);
+void mockSetMicros(unsigned long us);
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+//Flash is ordinary memory on the host
+#define PROGMEM
+#define PGM_P const char *
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define pgm_read_ptr(p) (*(void * const *)(p))
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define memcpy_P memcpy
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+#define lowByte(w) ((uint8_t)((w) & 0xff))
+#define highByte(w) ((uint8_t)((w) >> 8))
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t * buffer, size_t size) {
+      size_t n = 0;
+      while (size--) n += write(*buffer++);
+      return n;
+    }
+    size_t write(const char * str) { return write((const uint8_t *)str, strlen(str)); }
+    size_t write(const char * buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+    //Like the core: 0 unless the stream knows its buffer
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+//Records the written bytes and counts the write() calls. Input is queued with feed().
+class HardwareSerial : public Stream {
+  public:
+    std::vector<uint8_t> Output;
+    bool Record = true;                 //false: only count, for long benchmark runs
+    int TxRoom = 63;                    //availableForWrite(), the AVR core reports up to 63
+    unsigned long WriteCalls = 0;
+    unsigned long BytesWritten = 0;
+    unsigned long FlushCalls = 0;
+
+    void begin(unsigned long) {}
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t * buffer, size_t size) override;
+    using Print::write;
+    int availableForWrite() override { return TxRoom; }
+    void flush() override { FlushCalls++; }
+
+    int available() override { return (int)(Input.size() - InputPos); }
+    int read() override { return InputPos < Input.size() ? (uint8_t)Input[InputPos++] : -1; }
+    int peek() override { return InputPos < Input.size() ? (uint8_t)Input[InputPos] : -1; }
+
+    void feed(const char * text);
+    void clear();
+
+  private:
+    std::string Input;
+    size_t InputPos = 0;
+};
+
+extern HardwareSerial Serial;
+
+#endif // ASI_HOST_ARDUINO_H
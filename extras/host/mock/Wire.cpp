@@ -0,0 +1,138 @@
+#include "Wire.h"
+
+TwoWire Wire;
+
+TwoWire::TwoWire() {
+  resetCounters();
+}
+
+void TwoWire::begin() {
+  //Master: keeps a slave role of the same process, so both ends can live in one program
+}
+
+void TwoWire::begin(uint8_t address) {
+  SlaveAddress = address;
+}
+
+void TwoWire::end() {
+  SlaveAddress = -1;
+  ReceiveHandler = 0;
+  RequestHandler = 0;
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+  TargetAddress = address;
+  Transmitting = true;
+  TxLength = 0;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop) {
+  //Return codes of the AVR core: 0 success, 2 address NACK
+  Transmitting = false;
+  uint8_t length = TxLength;
+  uint8_t data[BUFFER_LENGTH];
+  memcpy(data, TxBuffer, length);
+  TxLength = 0;
+  bool acknowledged = deliverWrite(TargetAddress, data, length);
+  countTransfer(TargetAddress, acknowledged ? length : 0, acknowledged);
+  return acknowledged ? 0 : 2;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity) {
+  if (quantity > BUFFER_LENGTH) quantity = BUFFER_LENGTH;
+  RxLength = 0;
+  RxPos = 0;
+
+  TxLength = 0;
+  if (!deliverRequest(address)) {
+    countTransfer(address, 0, false);
+    return 0;
+  }
+  //The master clocks quantity bytes, a slave that wrote less leaves the bus high
+  for (uint8_t i = 0; i < quantity; i++) RxBuffer[i] = i < TxLength ? TxBuffer[i] : 0xFF;
+  TxLength = 0;
+  RxLength = quantity;
+  countTransfer(address, quantity, true);
+  return quantity;
+}
+
+void TwoWire::countTransfer(uint8_t address, unsigned int bytes, bool acknowledged) {
+  uint64_t time_ns = transferTime_ns(bytes);
+  mockAdvanceNanos(time_ns);
+
+  WireCounters * counters[2] = { &Counters, &AddressCounters[address & 0x7F] };
+  for (byte i = 0; i < 2; i++) {
+    counters[i]->Transactions++;
+    counters[i]->BytesOnBus += 1 + bytes;
+    counters[i]->BusTime_ns += time_ns;
+    if (!acknowledged) counters[i]->Nacks++;
+  }
+}
+
+size_t TwoWire::write(uint8_t c) {
+  Counters.WriteCalls++;
+  if (!Transmitting && !Answering) return 0;
+  if (TxLength >= BUFFER_LENGTH) return 0;
+  TxBuffer[TxLength++] = c;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t * buffer, size_t size) {
+  Counters.WriteCalls++;
+  size_t n = 0;
+  while (n < size && (Transmitting || Answering) && TxLength < BUFFER_LENGTH) TxBuffer[TxLength++] = buffer[n++];
+  return n;
+}
+
+int TwoWire::read() {
+  Counters.ReadCalls++;
+  return RxPos < RxLength ? RxBuffer[RxPos++] : -1;
+}
+
+void TwoWire::resetCounters() {
+  memset(&Counters, 0, sizeof(Counters));
+  memset(AddressCounters, 0, sizeof(AddressCounters));
+}
+
+bool TwoWire::deliverWrite(uint8_t address, const uint8_t * data, uint8_t length) {
+  //The general call (address 0) reaches every device, it is acknowledged if one of them listens
+  bool acknowledged = false;
+  for (uint8_t a = (address == 0 ? 1 : address); a <= (address == 0 ? 127 : address); a++) {
+    if (!isPresent(a)) continue;
+    receiveAt(a, data, length);
+    acknowledged = true;
+  }
+  return acknowledged;
+}
+
+void TwoWire::receiveAt(uint8_t address, const uint8_t * data, uint8_t length) {
+  //The slave reads the received bytes from the same object
+  memcpy(RxBuffer, data, length);
+  RxLength = length;
+  RxPos = 0;
+  if (Devices != 0 && Devices->acknowledges(address)) {
+    Devices->receive(address, length);
+  } else {
+    ReceiveHandler(length);
+  }
+  RxLength = 0;
+  RxPos = 0;
+}
+
+bool TwoWire::deliverRequest(uint8_t address) {
+  if (address == 0 || !isPresent(address)) return false;
+  Answering = true;
+  if (Devices != 0 && Devices->acknowledges(address)) {
+    Devices->request(address);
+  } else {
+    RequestHandler();
+  }
+  Answering = false;
+  return true;
+}
+
+bool TwoWire::isPresent(uint8_t address) {
+  //An attached bus answers before the loopback slave
+  if (Devices != 0 && Devices->acknowledges(address)) return true;
+  return SlaveAddress == address && ReceiveHandler != 0 && RequestHandler != 0;
+}
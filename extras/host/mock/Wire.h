@@ -0,0 +1,101 @@
+/*
+        File: Wire.h (host stand-in)
+        Description: TwoWire with the 32 byte buffers of the AVR core. A device that called
+                     begin(address) answers the transfers of the master in the same process
+                     through its onReceive()/onRequest() handlers, or the devices of an attached
+                     bus do (see sim/WireBus.h). Bytes and calls are counted and every transfer
+                     takes its bus time at the set clock on the simulated clock of Arduino.h.
+*/
+
+#ifndef ASI_HOST_WIRE_H
+#define ASI_HOST_WIRE_H
+
+#include "Arduino.h"
+
+#define BUFFER_LENGTH 32
+
+struct WireCounters {
+  unsigned long Transactions;   //writes and reads started by the master
+  unsigned long Nacks;          //address not acknowledged
+  unsigned long BytesOnBus;     //address bytes included
+  unsigned long WriteCalls;
+  unsigned long ReadCalls;
+  uint64_t BusTime_ns;          //START, 9 clocks per byte (with ACK), STOP
+};
+
+//Devices on the bus besides the loopback slave of begin(address)
+class WireBusDevices {
+  public:
+    virtual ~WireBusDevices() {}
+    virtual bool acknowledges(uint8_t address) = 0;
+    //The device reads the length received bytes from Wire
+    virtual void receive(uint8_t address, int length) = 0;
+    //The device writes its answer to Wire
+    virtual void request(uint8_t address) = 0;
+};
+
+class TwoWire : public Stream {
+  public:
+    WireCounters Counters;
+    WireCounters AddressCounters[128];  //per 7 bit address, the general call counts for address 0
+
+    TwoWire();
+
+    void begin();
+    void begin(uint8_t address);
+    void end();
+    void setClock(uint32_t frequency) { ClockFrequency = frequency; }
+    uint32_t getClock() const { return ClockFrequency; }
+    //One transfer with bytes data bytes: START, address byte, data bytes (8 bits and ACK each), STOP
+    uint64_t transferTime_ns(unsigned int bytes) const {
+      return (1 + 9 * (1 + (uint64_t)bytes) + 1) * 1000000000ULL / ClockFrequency;
+    }
+
+    void beginTransmission(uint8_t address);
+    uint8_t endTransmission(bool sendStop = true);
+    uint8_t requestFrom(uint8_t address, uint8_t quantity);
+    uint8_t requestFrom(int address, int quantity) { return requestFrom((uint8_t)address, (uint8_t)quantity); }
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t * buffer, size_t size) override;
+    using Print::write;
+    int available() override { return (int)(RxLength - RxPos); }
+    int read() override;
+    int peek() override { return RxPos < RxLength ? RxBuffer[RxPos] : -1; }
+
+    void onReceive(void (*handler)(int)) { ReceiveHandler = handler; }
+    void onRequest(void (*handler)()) { RequestHandler = handler; }
+
+    void resetCounters();
+    void attachDevices(WireBusDevices * devices) { Devices = devices; }
+
+  private:
+    //Hands a master write to the addressed slave (0: general call), false if nobody acknowledged
+    bool deliverWrite(uint8_t address, const uint8_t * data, uint8_t length);
+    //Fills TxBuffer with the slave's answer, false if nobody acknowledged
+    bool deliverRequest(uint8_t address);
+    void countTransfer(uint8_t address, unsigned int bytes, bool acknowledged);
+    void receiveAt(uint8_t address, const uint8_t * data, uint8_t length);
+    bool isPresent(uint8_t address);
+
+    WireBusDevices * Devices = 0;
+
+    uint32_t ClockFrequency = 100000;
+    int SlaveAddress = -1;
+    void (*ReceiveHandler)(int) = 0;
+    void (*RequestHandler)() = 0;
+
+    uint8_t TargetAddress = 0;
+    bool Transmitting = false;  //between beginTransmission() and endTransmission()
+    bool Answering = false;     //inside the onRequest handler
+
+    uint8_t TxBuffer[BUFFER_LENGTH];
+    uint8_t TxLength = 0;
+    uint8_t RxBuffer[BUFFER_LENGTH];
+    uint8_t RxLength = 0;
+    uint8_t RxPos = 0;
+};
+
+extern TwoWire Wire;
+
+#endif // ASI_HOST_WIRE_H
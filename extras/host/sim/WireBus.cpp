@@ -0,0 +1,35 @@
+#include "WireBus.h"
+
+WireBus::WireBus() {
+  memset(Slaves, 0, sizeof(Slaves));
+  Wire.attachDevices(this);
+}
+
+WireBus::~WireBus() {
+  //The slaves of this bus also leave the loopback slave of Wire behind
+  Wire.attachDevices(0);
+  Wire.end();
+}
+
+bool WireBus::attach(byte address, AdvancedSerial * slave) {
+  if (address == 0 || address > 127 || slave == 0) return false;
+  Slaves[address] = slave;
+  return true;
+}
+
+void WireBus::detach(byte address) {
+  Slaves[address & 0x7F] = 0;
+}
+
+bool WireBus::acknowledges(uint8_t address) {
+  return address <= 127 && Slaves[address] != 0;
+}
+
+void WireBus::receive(uint8_t address, int length) {
+  //What the onReceive handler of that device does
+  Slaves[address]->WireSlaveReceive();
+}
+
+void WireBus::request(uint8_t address) {
+  Slaves[address]->WireSlaveTransmitToMaster();
+}
@@ -0,0 +1,36 @@
+/*
+        File: WireBus.h
+        Description: Simulated I2C bus with several AdvancedSerial slaves in one host program.
+                     Master transfers on Wire reach the slave instances through their
+                     WireSlaveReceive()/WireSlaveTransmitToMaster(), Wire counts the transactions,
+                     bytes and bus time per address at the clock the master set.
+*/
+
+#ifndef ASI_HOST_WIREBUS_H
+#define ASI_HOST_WIREBUS_H
+
+#include "AdvancedSerial.h"
+
+class WireBus : public WireBusDevices {
+  public:
+    WireBus();
+    ~WireBus();
+
+    //Call after slave->begin(..., false, address): the slave answers at its address from now on
+    bool attach(byte address, AdvancedSerial * slave);
+    void detach(byte address);
+
+    bool acknowledges(uint8_t address) override;
+    void receive(uint8_t address, int length) override;
+    void request(uint8_t address) override;
+
+    //Counters of one address (see TwoWire::AddressCounters) and of the whole bus
+    const WireCounters & slaveCounters(byte address) const { return Wire.AddressCounters[address & 0x7F]; }
+    const WireCounters & busCounters() const { return Wire.Counters; }
+    void resetCounters() { Wire.resetCounters(); }
+
+  private:
+    AdvancedSerial * Slaves[128];
+};
+
+#endif // ASI_HOST_WIREBUS_H
@@ -0,0 +1,413 @@
+/*
+        File: AdvancedSerialTest.cpp
+        Description: Single device checks against the host stand-ins: command table, frames
+                     read back from Serial.
+*/
+
+#include "AdvancedSerial.h"
+#include <limits.h>
+#include <algorithm>
+
+static int Failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      Failures++; \
+    } \
+  } while (0)
+
+static int LastHandler = 0;
+
+static void handlerA(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  LastHandler = 1;
+}
+
+static void handlerB(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  LastHandler = 2;
+}
+
+static void handlerC(AdvancedSerial * asi, long * parameter, byte parameterCount, char * string_01) {
+  LastHandler = 3;
+}
+
+static int runCommand(AdvancedSerial & asi, const char * command) {
+  LastHandler = 0;
+  Serial.feed(command);
+  asi.Read();
+  return LastHandler;
+}
+
+//A name registered again replaces the handler, whether it is kept in flash or in RAM
+static void testRegisterCommand() {
+  Serial.clear();
+  AdvancedSerial asi;
+  asi.begin(&Serial, 1);
+  asi.setCommandEcho(false);
+
+  CHECK(asi.registerCommand(F("MYCMD"), handlerA));
+  CHECK(asi.registerCommand(F("MYCMD"), handlerB));
+  CHECK(runCommand(asi, "<MYCMD>") == 2);
+
+  char ramName[] = "MYCMD";
+  CHECK(asi.registerCommand(ramName, handlerC));
+  CHECK(runCommand(asi, "<MYCMD>") == 3);
+  CHECK(asi.registerCommand(F("MYCMD"), handlerA));
+  CHECK(runCommand(asi, "<MYCMD>") == 1);
+
+  //Replacing does not use up the table
+  for (int i = 0; i < 2 * ASI_MAX_COMMANDS; i++) CHECK(asi.registerCommand(F("MYCMD"), handlerB));
+  CHECK(runCommand(asi, "<MYCMD>") == 2);
+  CHECK(runCommand(asi, "<OTHER>") == 0);
+}
+
+//The first, a middle and the last built-in of the hash ordered table, a name with a built-in's hash prefix
+static void testBuiltinCommands() {
+  AdvancedSerial asi;
+  asi.begin(&Serial, 1);
+  asi.setCommandEcho(false);
+  int value = 5;
+  asi.addSignal("v", &value);
+
+  Serial.clear();
+  Serial.feed("<LOGGING_TIMESTAMPS,1><LOGGING_GETDATA,1,0,0,0>");
+  asi.Read();
+  asi.Read();
+  CHECK(Serial.Output.size() == 12 + 12 + 2 + 2 + 10 && Serial.Output[5] == 0xB1);
+
+  Serial.clear();
+  Serial.feed("<LOGGING_GETHASH,2,0,0,0>");
+  asi.Read();
+  CHECK(Serial.Output.size() == 12 + 6 + 10 && Serial.Output[5] == 0xB9);
+
+  Serial.clear();
+  Serial.feed("<LOGGING_GETHASHX,2,0,0,0><LOGGING_GETHAS,2,0,0,0>");
+  asi.Read();
+  asi.Read();
+  CHECK(Serial.Output.empty());
+
+  //Overridden built-in
+  CHECK(asi.registerCommand("LOGGING_LATCH", handlerA));
+  CHECK(runCommand(asi, "<LOGGING_LATCH>") == 1);
+}
+
+static long LastParameters[10];
+static byte LastParameterCount = 0;
+
+static void parameterCallback(char * command, long * parameter, byte parameterCount, char * string_01) {
+  memcpy(LastParameters, parameter, sizeof(LastParameters));
+  LastParameterCount = parameterCount;
+}
+
+//Parameters outside the range of long saturate instead of overflowing
+static void testParameterRange() {
+  AdvancedSerial asi;
+  asi.begin(&Serial, 1);
+  asi.setCommandEcho(false);
+  asi.setCommandCallback(parameterCallback);
+
+  Serial.feed("<CMD,99999999999999999999,-99999999999999999999,-12,+7,123x4,-,9223372036854775807,-9223372036854775808>");
+  asi.Read();
+  CHECK(LastParameterCount == 8);
+  CHECK(LastParameters[0] == LONG_MAX);
+  CHECK(LastParameters[1] == LONG_MIN);
+  CHECK(LastParameters[2] == -12);
+  CHECK(LastParameters[3] == 7);
+  CHECK(LastParameters[4] == 123);
+  CHECK(LastParameters[5] == 0);
+  CHECK(LastParameters[6] == LONG_MAX);
+  CHECK(LastParameters[7] == LONG_MIN);
+}
+
+//Blocking transmit: the echo is only written, data frames are flushed
+static void testEchoNotFlushed() {
+  AdvancedSerial asi;
+  asi.begin(&Serial, 1);
+  int value = 5;
+  asi.addSignal("v", &value);
+
+  Serial.clear();
+  Serial.feed("<OTHER,1>");
+  asi.Read();
+  CHECK(Serial.Output.size() == strlen("<OTHER,1>\r\n"));
+  CHECK(Serial.FlushCalls == 0);
+
+  Serial.clear();
+  Serial.feed("<LOGGING_GETDATA,1,0,0,0>");
+  asi.Read();
+  CHECK(Serial.FlushCalls == 1);
+}
+
+//Default configuration (no LOGGING_SETDELTA): one keyframe, then delta and compressed frames
+static void testDeltaWithoutKeyframeInterval() {
+  AdvancedSerial asi;
+  asi.begin(&Serial, 2);
+  asi.setCommandEcho(false);
+  long a = 100;
+  long b = 200;
+  asi.addSignal("a", &a);
+  asi.addSignal("b", &b);
+
+  Serial.clear();
+  asi.TransmitDeltaData(1, true);
+  CHECK(Serial.Output.size() > 5 && Serial.Output[5] == 0xB1);
+
+  b = 201;
+  Serial.clear();
+  Serial.feed("<LOGGING_GETDELTA,2,0,0,0>");
+  asi.Read();
+  CHECK(Serial.Output.size() == 12 + 2 + 4 + 10 && Serial.Output[5] == 0xB2);
+
+  Serial.clear();
+  Serial.feed("<LOGGING_GETDELTA,3,0,0,0>");
+  asi.Read();
+  CHECK(Serial.Output.size() == 12 + 10 && Serial.Output[5] == 0xB2);
+
+  //B5: a unchanged, b + 1 as zigzag varint
+  b = 202;
+  Serial.clear();
+  Serial.feed("<LOGGING_GETCOMPRESSED,4,0,0,0>");
+  asi.Read();
+  CHECK(Serial.Output.size() == 12 + 2 + 10 && Serial.Output[5] == 0xB5);
+  CHECK(Serial.Output.size() > 13 && Serial.Output[12] == 0 && Serial.Output[13] == 2);
+}
+
+//Bit by bit reference of CRC-16/CCITT-FALSE
+static uint16_t referenceCrc16(const std::vector<uint8_t> & data) {
+  uint16_t crc = 0xFFFF;
+  for (uint8_t c : data) {
+    crc ^= (uint16_t)c << 8;
+    for (int i = 0; i < 8; i++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+static std::vector<uint8_t> cobsDecode(const std::vector<uint8_t> & packet) {
+  std::vector<uint8_t> out;
+  size_t i = 0;
+  while (i < packet.size() && packet[i] != 0) {
+    uint8_t code = packet[i++];
+    for (uint8_t k = 1; k < code && i < packet.size(); k++) out.push_back(packet[i++]);
+    if (code < 0xFF && i < packet.size() && packet[i] != 0) out.push_back(0);
+  }
+  return out;
+}
+
+//Framed B1 frames with runs of zeros and runs longer than a COBS block decode to the plain
+//payload, followed by <LEN> and the CRC
+static void testFramedTransmit() {
+  static const unsigned int COUNT = 100;
+  float values[COUNT];
+  AdvancedSerial asi;
+  asi.begin(&Serial, COUNT);
+  for (unsigned int i = 0; i < COUNT; i++) {
+    values[i] = (i % 7 == 0) ? 0.0f : 1.0f + i;
+    asi.addSignal("v", &values[i]);
+  }
+  CHECK(asi.setFramedTransmit(true));
+
+  for (int run = 0; run < 2; run++) {
+    Serial.clear();
+    asi.TransmitData(0x01020304, true);
+    const std::vector<uint8_t> & out = Serial.Output;
+    CHECK(!out.empty() && out.back() == 0);
+    CHECK(std::count(out.begin(), out.end(), 0) == 1);
+
+    std::vector<uint8_t> decoded = cobsDecode(out);
+    CHECK(decoded.size() == 5 + COUNT * 6 + 4);
+    if (decoded.size() != 5 + COUNT * 6 + 4) return;
+    std::vector<uint8_t> payload(decoded.begin(), decoded.end() - 4);
+    CHECK(payload[0] == 0xB1 && payload[1] == 0x04 && payload[4] == 0x01);
+    float value;
+    memcpy(&value, &payload[5 + 3 * 6 + 2], 4);
+    CHECK(value == values[3]);
+    CHECK((decoded[payload.size()] | (decoded[payload.size() + 1] << 8)) == (int)payload.size());
+    uint16_t crc = referenceCrc16(std::vector<uint8_t>(decoded.begin(), decoded.end() - 2));
+    CHECK(decoded[decoded.size() - 2] == (crc >> 8) && decoded[decoded.size() - 1] == (crc & 0xFF));
+
+    for (unsigned int i = 0; i < COUNT; i++) values[i] = 1.5f + i;
+  }
+
+  //600 bytes without zero: full COBS blocks of 254 bytes
+  byte block[600];
+  memset(block, 0x55, sizeof(block));
+  AdvancedSerial blockAsi;
+  blockAsi.begin(&Serial, 1);
+  CHECK(blockAsi.addSignal("block", &block));
+  CHECK(blockAsi.setFramedTransmit(true));
+  Serial.clear();
+  blockAsi.TransmitData(0x01020304, true);
+  std::vector<uint8_t> decoded = cobsDecode(Serial.Output);
+  CHECK(std::count(Serial.Output.begin(), Serial.Output.end(), 0) == 1);
+  CHECK(decoded.size() == 5 + 2 + sizeof(block) + 4);
+  CHECK(std::count(decoded.begin(), decoded.end(), 0x55) >= (long)sizeof(block));
+  uint16_t crc = referenceCrc16(std::vector<uint8_t>(decoded.begin(), decoded.end() - 2));
+  CHECK(decoded.size() > 2 && decoded[decoded.size() - 2] == (crc >> 8) && decoded[decoded.size() - 1] == (crc & 0xFF));
+}
+
+static bool alwaysTrigger(AdvancedSerial * asi) {
+  return true;
+}
+
+//Async: a B7 window larger than the ring is dropped once and the capture released,
+//one that only waits for room is sent when the ring has drained
+static void testTriggerWindowInAsyncRing() {
+  Serial.clear();
+  AdvancedSerial asi;
+  asi.begin(&Serial, 2);
+  asi.setCommandEcho(false);
+  float a = 1;
+  float b = 2;
+  asi.addSignal("a", &a);
+  asi.addSignal("b", &b);
+  CHECK(asi.setSampleBuffer(20));
+  CHECK(asi.setAsyncTransmit(128));
+
+  CHECK(asi.setTrigger(alwaysTrigger, 5, 7));
+  for (int i = 0; i < 20; i++) asi.sample();
+  CHECK(asi.isCaptureComplete());
+  for (int i = 0; i < 1000; i++) asi.Read();
+  CHECK(Serial.BytesWritten == 0);
+  CHECK(asi.getDroppedFrames() == 1);
+  CHECK(!asi.isCaptureComplete());
+  CHECK(asi.sample());
+
+  //116 bytes fit the ring, but not behind the queued B0 frame
+  CHECK(asi.setSampleBuffer(7));
+  CHECK(asi.setTrigger(alwaysTrigger, 1, 8));
+  for (int i = 0; i < 7; i++) asi.sample();
+  CHECK(asi.isCaptureComplete());
+  Serial.TxRoom = 0;
+  asi.TransmitSymbols(1, true);
+  asi.Read();
+  CHECK(asi.isCaptureComplete());
+  CHECK(asi.getDroppedFrames() == 1);
+  Serial.TxRoom = 63;
+  for (int i = 0; i < 10 && asi.isCaptureComplete(); i++) asi.Read();
+  CHECK(!asi.isCaptureComplete());
+  CHECK(asi.getDroppedFrames() == 1);
+}
+
+//Scaled signals take a descriptor slot, AdvancedSerialStatic only has the ones it reserves
+static void testScaledDescriptorSlots() {
+  Serial.clear();
+  float a = 1.5f;
+  float b = -2.0f;
+  AdvancedSerialStatic<3, 0, 1> asi;
+  asi.begin(&Serial);
+  CHECK(asi.addSignal("a", &a, 0.5f, 0.0f));
+  CHECK(!asi.addSignal("b", &b, 0.5f, 0.0f));
+  CHECK(asi.addSignal("b", &b));
+
+  //deleteSignals() frees the slots
+  asi.deleteSignals();
+  CHECK(asi.addSignal("b", &b, 0.5f, 0.0f));
+  Serial.clear();
+  asi.TransmitData(0, true);
+  const std::vector<uint8_t> & out = Serial.Output;
+  CHECK(out.size() == 12 + 2 + 2 + 10);
+  CHECK(out.size() > 15 && (int16_t)(out[14] | (out[15] << 8)) == -4);
+
+  AdvancedSerialStatic<3> none;
+  none.begin(&Serial);
+  CHECK(!none.addSignal("a", &a, 0.5f, 0.0f));
+
+  AdvancedSerial dynamic;
+  dynamic.begin(&Serial, 2);
+  CHECK(dynamic.addSignal("a", &a, 0.5f, 0.0f));
+  CHECK(dynamic.addSignal("b", &b, 0.5f, 0.0f, 8));
+  CHECK(!dynamic.addSignal("c", &b, 0.5f, 0.0f));
+
+  //The slots grow past ASI_DESCRIPTOR_STEP, the signals registered before move along
+  static const unsigned int COUNT = 3 * ASI_DESCRIPTOR_STEP + 1;
+  float values[COUNT];
+  AdvancedSerial many;
+  many.begin(&Serial, 100);
+  for (unsigned int i = 0; i < COUNT; i++) {
+    values[i] = i;
+    CHECK(many.addSignal("v", &values[i], 0.25f, 1.0f));
+  }
+  Serial.clear();
+  many.TransmitData(0, true);
+  CHECK(Serial.Output.size() == 12 + COUNT * 4 + 10);
+  for (unsigned int i = 0; i < COUNT && 12 + i * 4 + 4 <= Serial.Output.size(); i++) {
+    const uint8_t * item = &Serial.Output[12 + i * 4];
+    CHECK((item[0] | (item[1] << 8)) == (int)i);
+    CHECK((int16_t)(item[2] | (item[3] << 8)) == (int16_t)((values[i] - 1.0f) / 0.25f));
+  }
+}
+
+struct TestBlock {
+  byte flags;
+  float gain[2];
+};
+
+//Blocks take a descriptor slot, a struct keeps pointing to the caller's layout
+static void testBlockDescriptorSlots() {
+  static const ASIField layout[] = { ASI_FIELD(TestBlock, flags), ASI_FIELD(TestBlock, gain) };
+  TestBlock block = { 7, { 1.0f, 2.0f } };
+  int array[3] = { 1, -2, 3 };
+
+  AdvancedSerialStatic<3, 16, 2> asi;
+  asi.begin(&Serial);
+  CHECK(asi.addSignal("block", &block, layout, 2));
+  CHECK(asi.addSignal("array", &array));
+  CHECK(!asi.addSignal("more", array, 2));
+
+  Serial.clear();
+  asi.TransmitData(0, true);
+  const std::vector<uint8_t> & out = Serial.Output;
+  CHECK(out.size() == 12 + (2 + 1 + 8) + (2 + 6) + 10);
+  if (out.size() < 12 + 19) return;
+  float gain1;
+  memcpy(&gain1, &out[12 + 2 + 1 + 4], 4);
+  CHECK(out[14] == 7 && gain1 == 2.0f);
+  CHECK((int16_t)(out[12 + 11 + 2 + 2] | (out[12 + 11 + 2 + 3] << 8)) == -2);
+
+  //AdvancedSerial grows the slots, the blocks registered before move along
+  static const unsigned int COUNT = 2 * ASI_DESCRIPTOR_STEP + 1;
+  AdvancedSerial many;
+  many.begin(&Serial, 100);
+  for (unsigned int i = 0; i < COUNT; i++) {
+    CHECK((i % 2 == 0) ? many.addSignal("array", &array) : many.addSignal("block", &block, layout, 2));
+  }
+  Serial.clear();
+  many.TransmitData(0, true);
+  CHECK(Serial.Output.size() == 12 + (COUNT / 2 + 1) * (2 + 6) + (COUNT / 2) * (2 + 9) + 10);
+  size_t p = 12;
+  for (unsigned int i = 0; i < COUNT && p + 11 <= Serial.Output.size(); i++) {
+    CHECK((Serial.Output[p] | (Serial.Output[p + 1] << 8)) == (int)i);
+    if (i % 2 == 0) {
+      CHECK((int16_t)(Serial.Output[p + 4] | (Serial.Output[p + 5] << 8)) == -2);
+      p += 2 + 6;
+    } else {
+      memcpy(&gain1, &Serial.Output[p + 2 + 1 + 4], 4);
+      CHECK(Serial.Output[p + 2] == 7 && gain1 == 2.0f);
+      p += 2 + 9;
+    }
+  }
+
+  Serial.clear();
+  many.TransmitSymbols(0, true);
+  CHECK(Serial.Output.size() == 12 + (COUNT / 2 + 1) * (2 + 6 + 1 + 1 + 3) + (COUNT / 2) * (2 + 6 + 1 + 1 + 6) + 10);
+}
+
+int main() {
+  testRegisterCommand();
+  testBuiltinCommands();
+  testEchoNotFlushed();
+  testParameterRange();
+  testFramedTransmit();
+  testDeltaWithoutKeyframeInterval();
+  testTriggerWindowInAsyncRing();
+  testScaledDescriptorSlots();
+  testBlockDescriptorSlots();
+
+  if (Failures > 0) {
+    printf("%d check(s) failed\n", Failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,344 @@
+/*
+        File: WireBusTest.cpp
+        Description: Master sweeps over a simulated bus with several slaves (see sim/WireBus.h).
+                     Checks the collected values and the transactions, bytes and bus time per
+                     slave against the packed chunk format, prints the sweep latencies.
+*/
+
+#include "WireBus.h"
+#include <memory>
+
+static int Failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      Failures++; \
+    } \
+  } while (0)
+
+static const unsigned int FRAME_HEADER = 12; // #ASI:<KEY>:<MSGID u32>:
+
+//One slave device: its own stream and signals, answering at Address
+struct SimSlave {
+  byte Address;
+  HardwareSerial Port;
+  AdvancedSerial Asi;
+  std::vector<float> Values;
+  std::vector<std::string> Names;
+
+  SimSlave(WireBus & bus, uint32_t clock, byte address, unsigned int count) : Address(address), Values(count), Names(count) {
+    Asi.begin(&Port, count, clock, false, address);
+    for (unsigned int i = 0; i < count; i++) {
+      Names[i] = "v" + std::to_string(i);
+      Values[i] = address * 1000.0f + i;
+      Asi.addSignal(Names[i].c_str(), &Values[i]);
+    }
+    bus.attach(address, &Asi);
+  }
+};
+
+struct SimSetup {
+  WireBus Bus;
+  AdvancedSerial Master;
+  std::vector<std::unique_ptr<SimSlave> > Slaves;
+
+  SimSetup(uint32_t clock, const std::vector<unsigned int> & signalCounts) {
+    Serial.clear();
+    Serial.Record = true;
+    for (size_t s = 0; s < signalCounts.size(); s++) {
+      Slaves.emplace_back(new SimSlave(Bus, clock, 8 + s, signalCounts[s]));
+    }
+    Master.begin(&Serial, 1, clock, true, 0);
+  }
+};
+
+//Packed chunks a slave needs for count float values, same rule as WireSlaveTransmitPacked()
+static unsigned int expectedChunks(unsigned int count) {
+  unsigned int chunks = 0;
+  while (count > 0) {
+    unsigned int n = 0;
+    unsigned int length = 0;
+    while (n < count && 2 + (n + 4) / 4 + length + 4 <= ASI_WIRE_CHUNK_LENGTH) {
+      length += 4;
+      n++;
+    }
+    count -= n;
+    chunks++;
+  }
+  return chunks;
+}
+
+//Checks that the B1 frame in Serial holds the IDs and values of all slaves in order
+static void checkSweepFrame(SimSetup & sim) {
+  const std::vector<uint8_t> & out = Serial.Output;
+  CHECK(out.size() > FRAME_HEADER && out[5] == 0xB1);
+  size_t p = FRAME_HEADER + 2 + 2; //the master's own int, 16 bit like on AVR
+  unsigned int id = 1;
+  for (auto & slave : sim.Slaves) {
+    for (size_t i = 0; i < slave->Values.size(); i++, id++) {
+      if (p + 6 > out.size()) {
+        CHECK(p + 6 <= out.size());
+        return;
+      }
+      float value;
+      memcpy(&value, &out[p + 2], 4);
+      CHECK((unsigned int)(out[p] | (out[p + 1] << 8)) == id);
+      CHECK(value == slave->Values[i]);
+      p += 6;
+    }
+  }
+  CHECK(out.size() == p + 10 && memcmp(&out[p], "ENDOFASI", 8) == 0);
+}
+
+static void testDiscovery() {
+  SimSetup sim(400000, { 5, 20, 40 });
+  static int local = 7;
+  sim.Master.addSignal("local", &local);
+
+  sim.Bus.resetCounters();
+  CHECK(sim.Master.discoverSlaves(1, 127) == 3);
+  //One info write per address, an info read from each slave that answered
+  CHECK(sim.Bus.busCounters().Transactions == 127 + 3);
+  CHECK(sim.Bus.busCounters().Nacks == 127 - 3);
+  CHECK(sim.Bus.slaveCounters(9).Transactions == 2);
+  CHECK(sim.Bus.slaveCounters(9).BytesOnBus == 2 + 8);
+
+  //Removed slave drops out of the list on the next scan
+  sim.Bus.detach(9);
+  CHECK(sim.Master.discoverSlaves(1, 127) == 2);
+
+  //Command ranges are clamped to 0x08..0x77 before they are narrowed to byte
+  sim.Master.setCommandEcho(false);
+  sim.Bus.resetCounters();
+  Serial.feed("<LOGGING_DISCOVER,-1,300>");
+  sim.Master.Read();
+  CHECK(sim.Bus.busCounters().Transactions == (0x77 - 0x08 + 1) + 2);
+  CHECK(sim.Master.getSlaveCount() == 2);
+  sim.Bus.resetCounters();
+  Serial.feed("<LOGGING_DISCOVER,300,-1>");
+  sim.Master.Read();
+  CHECK(sim.Bus.busCounters().Transactions == 0);
+}
+
+static void testSweep(uint32_t clock) {
+  std::vector<unsigned int> counts = { 1, 7, 8, 30, 64 };
+  SimSetup sim(clock, counts);
+  static int local = 7;
+  sim.Master.addSignal("local", &local);
+  sim.Master.discoverSlaves(1, 127);
+
+  sim.Bus.resetCounters();
+  Serial.clear();
+  unsigned long start_us = micros();
+  sim.Master.WireTransmitData(1, true);
+  unsigned long sweep_us = micros() - start_us;
+  checkSweepFrame(sim);
+
+  uint64_t expectedTime_ns = 0;
+  for (size_t s = 0; s < counts.size(); s++) {
+    const WireCounters & c = sim.Bus.slaveCounters(sim.Slaves[s]->Address);
+    unsigned int chunks = expectedChunks(counts[s]);
+    //Mode select write + one 32 byte read per chunk
+    CHECK(c.Transactions == 1 + chunks);
+    CHECK(c.Nacks == 0);
+    CHECK(c.BytesOnBus == 2 + chunks * (1 + ASI_WIRE_CHUNK_LENGTH));
+    CHECK(c.BusTime_ns == Wire.transferTime_ns(1) + chunks * Wire.transferTime_ns(ASI_WIRE_CHUNK_LENGTH));
+    expectedTime_ns += c.BusTime_ns;
+  }
+  CHECK(sim.Bus.busCounters().BusTime_ns == expectedTime_ns);
+  CHECK(sweep_us == micros() - start_us && sweep_us >= expectedTime_ns / 1000);
+
+  printf("sweep at %6lu Hz: %lu transactions, %lu bytes, %lu us\n", (unsigned long)clock,
+         sim.Bus.busCounters().Transactions, sim.Bus.busCounters().BytesOnBus, sweep_us);
+  for (size_t s = 0; s < counts.size(); s++) {
+    const WireCounters & c = sim.Bus.slaveCounters(sim.Slaves[s]->Address);
+    printf("  slave %u, %3u signals: %2lu transactions, %4lu bytes, %6lu us\n", sim.Slaves[s]->Address, counts[s],
+           c.Transactions, c.BytesOnBus, (unsigned long)(c.BusTime_ns / 1000));
+  }
+}
+
+static void testClockScaling() {
+  uint64_t time_ns[2];
+  uint32_t clocks[2] = { 100000, 400000 };
+  for (int i = 0; i < 2; i++) {
+    SimSetup sim(clocks[i], { 32, 32 });
+    sim.Master.discoverSlaves(8, 9);
+    sim.Bus.resetCounters();
+    sim.Master.WireTransmitData(1, true);
+    time_ns[i] = sim.Bus.busCounters().BusTime_ns;
+  }
+  //Same transfers, a quarter of the time
+  CHECK(time_ns[1] * 4 <= time_ns[0] + 4 && time_ns[1] * 4 + 4 >= time_ns[0]);
+}
+
+static void testSymbols() {
+  SimSetup sim(400000, { 3, 2 });
+  sim.Master.discoverSlaves(1, 127);
+  Serial.clear();
+  sim.Bus.resetCounters();
+  sim.Master.WireTransmitSymbols(1, true);
+  std::string frame(Serial.Output.begin(), Serial.Output.end());
+  CHECK(frame.find(std::string("S8_v2\0", 6)) != std::string::npos);
+  CHECK(frame.find(std::string("S9_v1\0", 6)) != std::string::npos);
+  //Mode select + one symbol per read
+  CHECK(sim.Bus.slaveCounters(8).Transactions >= 1 + 3);
+}
+
+static void testLatch() {
+  SimSetup sim(400000, { 4, 4, 4 });
+  sim.Master.discoverSlaves(1, 127);
+  for (auto & slave : sim.Slaves) slave->Asi.publishSnapshot();
+
+  //The general call reaches all slaves at once, later changes are not in the sweep,
+  //not even when the slaves publish them before the master reads
+  sim.Bus.resetCounters();
+  sim.Master.latchSlaves();
+  CHECK(sim.Bus.slaveCounters(0).Transactions == 1);
+  std::vector<float> latched;
+  for (auto & slave : sim.Slaves) {
+    for (float & value : slave->Values) {
+      latched.push_back(value);
+      value += 0.5f;
+    }
+    CHECK(!slave->Asi.publishSnapshot());
+    CHECK(!slave->Asi.publishSnapshot());
+  }
+
+  Serial.clear();
+  sim.Master.WireTransmitData(1, true);
+  CHECK(Serial.Output.size() == FRAME_HEADER + latched.size() * 6 + 10);
+  size_t p = FRAME_HEADER;
+  for (size_t i = 0; i < latched.size() && p + 6 <= Serial.Output.size(); i++, p += 6) {
+    float value;
+    memcpy(&value, &Serial.Output[p + 2], 4);
+    CHECK(value == latched[i]);
+  }
+
+  //Read by the master: the slaves publish again
+  for (auto & slave : sim.Slaves) CHECK(slave->Asi.publishSnapshot());
+  Serial.clear();
+  sim.Master.WireTransmitData(1, true);
+  p = FRAME_HEADER;
+  for (size_t i = 0; i < latched.size() && p + 6 <= Serial.Output.size(); i++, p += 6) {
+    float value;
+    memcpy(&value, &Serial.Output[p + 2], 4);
+    CHECK(value == latched[i] + 0.5f);
+  }
+}
+
+//A snapshot published before the signal list changed is replaced, the master reads all signals
+static void testSnapshotAfterAddSignal() {
+  SimSetup sim(400000, { 6, 6 });
+  static int local = 7;
+  sim.Master.addSignal("local", &local);
+  for (auto & slave : sim.Slaves) {
+    slave->Asi.deleteSignals();
+    for (unsigned int i = 0; i < 3; i++) slave->Asi.addSignal(slave->Names[i].c_str(), &slave->Values[i]);
+    CHECK(slave->Asi.publishSnapshot());
+    for (unsigned int i = 3; i < 6; i++) slave->Asi.addSignal(slave->Names[i].c_str(), &slave->Values[i]);
+  }
+  CHECK(sim.Master.discoverSlaves(1, 127) == 2);
+  Serial.clear();
+  sim.Master.WireTransmitData(1, true);
+  checkSweepFrame(sim);
+
+  //Still answered from a snapshot: changes only show after the next publish
+  float old = sim.Slaves[0]->Values[5];
+  sim.Slaves[0]->Values[5] += 1;
+  Serial.clear();
+  sim.Master.WireTransmitData(1, true);
+  float value = 0;
+  size_t p = FRAME_HEADER + 4 + 5 * 6 + 2;
+  if (p + 4 <= Serial.Output.size()) memcpy(&value, &Serial.Output[p], 4);
+  CHECK(value == old);
+}
+
+static void testBackgroundPolling() {
+  SimSetup sim(400000, { 10, 40 });
+  sim.Master.discoverSlaves(1, 127);
+  sim.Master.setBackgroundPolling(100);
+
+  //At most one transaction per update(), the sweep completes over several calls
+  sim.Bus.resetCounters();
+  unsigned long updates = 0;
+  unsigned long lastTransactions = 0;
+  unsigned long expectedTransactions = 2 + expectedChunks(10) + expectedChunks(40);
+  while (sim.Bus.busCounters().Transactions < expectedTransactions && updates < 100) {
+    sim.Master.update();
+    CHECK(sim.Bus.busCounters().Transactions - lastTransactions <= 1);
+    lastTransactions = sim.Bus.busCounters().Transactions;
+    updates++;
+  }
+  CHECK(sim.Bus.busCounters().Transactions == expectedTransactions);
+
+  //Requests are answered from the cache without bus traffic
+  Serial.clear();
+  sim.Bus.resetCounters();
+  sim.Master.WireTransmitData(1, true);
+  CHECK(sim.Bus.busCounters().Transactions == 0);
+  CHECK(Serial.Output.size() > FRAME_HEADER && Serial.Output[5] == 0xB1);
+}
+
+//Answers the data reads of one address with a fixed, corrupt chunk, everything else goes to the bus
+struct GlitchDevices : WireBusDevices {
+  WireBus & Bus;
+  byte Address;
+  std::vector<uint8_t> Chunk;
+
+  GlitchDevices(WireBus & bus, byte address) : Bus(bus), Address(address) {}
+  bool acknowledges(uint8_t address) override { return Bus.acknowledges(address); }
+  void receive(uint8_t address, int length) override { Bus.receive(address, length); }
+  void request(uint8_t address) override {
+    if (address == Address) {
+      Wire.write(Chunk.data(), Chunk.size());
+    } else {
+      Bus.request(address);
+    }
+  }
+};
+
+static void testCorruptChunks() {
+  SimSetup sim(400000, { 4 });
+  sim.Master.discoverSlaves(1, 127);
+  GlitchDevices glitch(sim.Bus, 8);
+  Wire.attachDevices(&glitch);
+
+  //count without codes/values, length beyond the chunk, sizes not adding up to length, more values than expected
+  const std::vector<std::vector<uint8_t> > chunks = {
+    { 100, 0 },
+    { 0x83, 200, 0xAA },
+    { 0x82, 5, 0x0A, 1, 2, 3, 4, 5, 6, 7, 8 },
+    { 0x85, 5, 0x00, 0x00, 1, 2, 3, 4, 5 },
+  };
+  for (const auto & chunk : chunks) {
+    glitch.Chunk = chunk;
+    sim.Master.resetStats();
+    Serial.clear();
+    sim.Master.WireTransmitData(1, true);
+    //Only header and trailer, every chunk is rejected
+    CHECK(Serial.Output.size() == FRAME_HEADER + 10);
+    CHECK(sim.Master.getStats().WireEmpty == 4 + 4);
+  }
+  Wire.attachDevices(&sim.Bus);
+}
+
+int main() {
+  testDiscovery();
+  testSweep(100000);
+  testSweep(400000);
+  testClockScaling();
+  testSymbols();
+  testLatch();
+  testSnapshotAfterAddSignal();
+  testBackgroundPolling();
+  testCorruptChunks();
+
+  if (Failures > 0) {
+    printf("%d check(s) failed\n", Failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}